@@ -0,0 +1,350 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+// Micro-benchmark of the event decoding done in TR_CAEN::processBurstData.
+//
+// For each combination of channel mask, record length and events per block
+// transfer, an aggregate (the data of one ReadData) is generated with
+// TR_CAEN_EventGen and decoded repeatedly with each available sample unpack
+// kernel, to raw samples and to volts. The output of every kernel is checked
+// against the scalar kernel. Reported are the throughput in samples and in
+// bytes of board data, percentiles of the time to decode one event, and the
+// number of heap allocations (operator new) per event. The throughput
+// includes the overhead of timing each event, which matters for small events.
+//
+// Usage: CAENDecodeBench [-m masks] [-r record_lengths] [-b events_per_blt] [-t seconds]
+// Lists are comma-separated, masks are hexadecimal. For example:
+//   CAENDecodeBench -m ff -r 1024,65536 -b 1,64 -t 2
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <new>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "TR_CAEN_BitUtils.h"
+#include "TR_CAEN_Decoder.h"
+#include "TR_CAEN_EventGen.h"
+#include "TR_CAEN_SampleUnpack.h"
+
+// Number of channels of the x730.
+static int const NumChannels = 8;
+
+// Aggregates larger than this are reduced to fewer events.
+static size_t const MaxAggregateBytes = 64 * 1024 * 1024;
+
+// Maximum number of event latencies recorded for the percentiles.
+static size_t const MaxLatencySamples = 1 << 20;
+
+// Conversion to volts used for the scaled kernels (2 Vpp range).
+static float const VoltsScale = 2.0f / 16384.0f;
+static float const VoltsOffset = -1.0f;
+
+// Count of heap allocations, to verify that decoding does not allocate.
+static unsigned long num_allocations = 0;
+
+void * operator new (size_t size)
+{
+    num_allocations++;
+    void *ptr = ::malloc((size > 0) ? size : 1);
+    if (ptr == NULL) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void * operator new[] (size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete (void *ptr) throw()
+{
+    ::free(ptr);
+}
+
+void operator delete[] (void *ptr) throw()
+{
+    ::free(ptr);
+}
+
+void operator delete (void *ptr, size_t size) throw()
+{
+    ::free(ptr);
+}
+
+void operator delete[] (void *ptr, size_t size) throw()
+{
+    ::free(ptr);
+}
+
+static double monotonicSeconds ()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool parseList (char const *str, int base, std::vector<unsigned long> *out)
+{
+    out->clear();
+    
+    char const *pos = str;
+    while (*pos != '\0') {
+        char *end;
+        unsigned long value = ::strtoul(pos, &end, base);
+        if (end == pos || (*end != ',' && *end != '\0') || value == 0) {
+            return false;
+        }
+        out->push_back(value);
+        pos = (*end == ',') ? end + 1 : end;
+    }
+    
+    return !out->empty();
+}
+
+// Output buffers of the channels, like the NDArrays in the driver.
+struct BenchOutput {
+    std::vector<int16_t> raw[NumChannels];
+    std::vector<float> volts[NumChannels];
+};
+
+// Decodes one event like processBurstData, returning the number of words
+// consumed or 0 on error.
+static size_t decodeEvent (uint32_t const *data, size_t num_words, TR_CAEN_UnpackKernel const *kernel,
+                           bool volts, BenchOutput &out)
+{
+    TR_CAEN_EventHeader header;
+    if (!TR_CAEN_DecodeEventHeader(data, num_words, &header)) {
+        return 0;
+    }
+    
+    size_t num_samples = TR_CAEN_EventNumSamples(header);
+    uint32_t const *ch_data = data + TR_CAEN_EventHeaderWords;
+    
+    for (int ch = 0; ch < NumChannels; ch++) {
+        if (!TR_CAEN_GetBit(header.channel_mask, ch)) {
+            continue;
+        }
+        
+        if (volts) {
+            kernel->unpack_scaled(ch_data, &out.volts[ch][0], num_samples, VoltsScale, VoltsOffset);
+        } else {
+            kernel->unpack(ch_data, &out.raw[ch][0], num_samples);
+        }
+        
+        ch_data += num_samples / 2;
+    }
+    
+    return header.size_words;
+}
+
+// Checks that a kernel gives the same output as the scalar kernel.
+static bool checkKernel (std::vector<uint32_t> const &aggregate, TR_CAEN_UnpackKernel const *kernel,
+                         BenchOutput &ref_out, BenchOutput &out)
+{
+    TR_CAEN_UnpackKernel const *scalar = TR_CAEN_GetUnpackKernel(TR_CAEN_UnpackImplScalar);
+    
+    for (int volts = 0; volts < 2; volts++) {
+        for (size_t pos = 0; pos < aggregate.size(); ) {
+            size_t words = decodeEvent(&aggregate[pos], aggregate.size() - pos, scalar, volts, ref_out);
+            if (words == 0 || decodeEvent(&aggregate[pos], aggregate.size() - pos, kernel, volts, out) != words) {
+                return false;
+            }
+            
+            for (int ch = 0; ch < NumChannels; ch++) {
+                bool same = volts ?
+                    ::memcmp(&ref_out.volts[ch][0], &out.volts[ch][0], out.volts[ch].size() * sizeof(float)) == 0 :
+                    ::memcmp(&ref_out.raw[ch][0], &out.raw[ch][0], out.raw[ch].size() * sizeof(int16_t)) == 0;
+                if (!same) {
+                    return false;
+                }
+            }
+            
+            pos += words;
+        }
+    }
+    
+    return true;
+}
+
+static double percentile (std::vector<double> const &sorted, double fraction)
+{
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    size_t index = std::min(sorted.size() - 1, (size_t)(fraction * sorted.size()));
+    return sorted[index];
+}
+
+static void runCase (uint32_t channel_mask, size_t record_length, size_t events_per_blt, double min_seconds)
+{
+    int num_channels = 0;
+    for (int ch = 0; ch < NumChannels; ch++) {
+        num_channels += TR_CAEN_GetBit(channel_mask, ch);
+    }
+    
+    // Generate the aggregate.
+    TR_CAEN_EventGen event_gen;
+    event_gen.setConfig(TR_CAEN_EventGenConfig());
+    event_gen.prepare(channel_mask, record_length, record_length / 4);
+    
+    size_t event_words = event_gen.getEventWords();
+    events_per_blt = std::max((size_t)1, std::min(events_per_blt, MaxAggregateBytes / (event_words * sizeof(uint32_t))));
+    
+    std::vector<uint32_t> aggregate(events_per_blt * event_words);
+    for (size_t i = 0; i < events_per_blt; i++) {
+        event_gen.generateEvent(&aggregate[i * event_words], 0, i, i * 1000);
+    }
+    
+    BenchOutput out;
+    BenchOutput ref_out;
+    for (int ch = 0; ch < NumChannels; ch++) {
+        out.raw[ch].resize(record_length);
+        out.volts[ch].resize(record_length);
+        ref_out.raw[ch].resize(record_length);
+        ref_out.volts[ch].resize(record_length);
+    }
+    
+    std::vector<double> latencies;
+    latencies.reserve(MaxLatencySamples);
+    
+    for (int impl = 0; impl < TR_CAEN_NumUnpackImpls; impl++) {
+        TR_CAEN_UnpackKernel const *kernel = TR_CAEN_GetUnpackKernel((TR_CAEN_UnpackImpl)impl);
+        if (kernel == NULL) {
+            continue;
+        }
+        
+        bool check_ok = checkKernel(aggregate, kernel, ref_out, out);
+        
+        for (int volts = 0; volts < 2; volts++) {
+            latencies.clear();
+            
+            unsigned long allocations_before = num_allocations;
+            double start_time = monotonicSeconds();
+            double elapsed = 0.0;
+            size_t num_events = 0;
+            
+            // Decode the aggregate repeatedly until enough time has passed.
+            do {
+                size_t pos = 0;
+                while (pos < aggregate.size()) {
+                    double event_start = monotonicSeconds();
+                    size_t words = decodeEvent(&aggregate[pos], aggregate.size() - pos, kernel, volts, out);
+                    double event_end = monotonicSeconds();
+                    
+                    if (words == 0) {
+                        fprintf(stderr, "CAENDecodeBench Error: decoding failed.\n");
+                        exit(1);
+                    }
+                    
+                    if (latencies.size() < MaxLatencySamples) {
+                        latencies.push_back(event_end - event_start);
+                    }
+                    
+                    pos += words;
+                    num_events++;
+                }
+                
+                elapsed = monotonicSeconds() - start_time;
+            } while (elapsed < min_seconds);
+            
+            unsigned long allocations = num_allocations - allocations_before;
+            
+            std::sort(latencies.begin(), latencies.end());
+            
+            double samples = (double)num_events * num_channels * record_length;
+            double bytes = (double)num_events * event_words * sizeof(uint32_t);
+            
+            printf("%04x %2d %8lu %5lu %-6s %-5s %9.1f %7.3f %9.0f %9.0f %9.0f %9.0f %8.3f %s\n",
+                (unsigned int)channel_mask, num_channels, (unsigned long)record_length,
+                (unsigned long)events_per_blt, kernel->name, volts ? "volts" : "raw",
+                samples / elapsed / 1e6, bytes / elapsed / 1e9,
+                percentile(latencies, 0.5) * 1e9, percentile(latencies, 0.9) * 1e9,
+                percentile(latencies, 0.99) * 1e9, percentile(latencies, 0.999) * 1e9,
+                (double)allocations / num_events, check_ok ? "ok" : "MISMATCH");
+            fflush(stdout);
+        }
+    }
+}
+
+static void usage ()
+{
+    fprintf(stderr, "Usage: CAENDecodeBench [-m masks] [-r record_lengths] [-b events_per_blt] [-t seconds]\n");
+}
+
+int main (int argc, char *argv[])
+{
+    std::vector<unsigned long> masks;
+    std::vector<unsigned long> record_lengths;
+    std::vector<unsigned long> events_per_blts;
+    double min_seconds = 0.5;
+    
+    parseList("1,f,ff", 16, &masks);
+    parseList("256,4096,65536", 10, &record_lengths);
+    parseList("1,32,1023", 10, &events_per_blts);
+    
+    int opt;
+    while ((opt = getopt(argc, argv, "m:r:b:t:h")) != -1) {
+        bool ok = true;
+        switch (opt) {
+            case 'm':
+                ok = parseList(optarg, 16, &masks);
+                break;
+            case 'r':
+                ok = parseList(optarg, 10, &record_lengths);
+                break;
+            case 'b':
+                ok = parseList(optarg, 10, &events_per_blts);
+                break;
+            case 't':
+                min_seconds = ::atof(optarg);
+                break;
+            default:
+                ok = false;
+                break;
+        }
+        if (!ok) {
+            usage();
+            return 1;
+        }
+    }
+    
+    for (size_t i = 0; i < masks.size(); i++) {
+        if (masks[i] > 0xFF) {
+            fprintf(stderr, "CAENDecodeBench Error: channel mask must be within 0-ff.\n");
+            return 1;
+        }
+    }
+    for (size_t i = 0; i < record_lengths.size(); i++) {
+        if (record_lengths[i] % 4 != 0) {
+            fprintf(stderr, "CAENDecodeBench Error: record lengths must be multiples of 4.\n");
+            return 1;
+        }
+    }
+    
+    printf("mask ch  rec_len ev/bt kernel format      MS/s    GB/s    p50_ns    p90_ns    p99_ns  p99.9_ns alloc/ev check\n");
+    
+    for (size_t m = 0; m < masks.size(); m++) {
+        for (size_t r = 0; r < record_lengths.size(); r++) {
+            for (size_t b = 0; b < events_per_blts.size(); b++) {
+                runCase(masks[m], record_lengths[r], events_per_blts[b], min_seconds);
+            }
+        }
+    }
+    
+    return 0;
+}
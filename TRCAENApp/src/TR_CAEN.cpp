@@ -8,9 +8,11 @@
  */
 
 #include <limits.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <cmath>
 #include <string>
@@ -20,18 +22,22 @@
 #include <epicsGuard.h>
 #include <epicsThread.h>
 #include <epicsAssert.h>
+#include <epicsAtomic.h>
+#include <epicsTime.h>
 
 #include <TRChannelDataSubmit.h>
 
-#include <CAENDigitizer.h>
 #include <CAENDigitizerType.h>
 
 #include "TR_CAEN.h"
-#include "TR_CAEN_DevAddrStr.h"
 #include "TR_CAEN_BitUtils.h"
+#include "TR_CAEN_Decoder.h"
+
+double const TR_CAEN::StatusCheckInterval = 0.1;
 
 TR_CAEN::TR_CAEN (
-    char const *port_name, char const *device_addr_str,
+    char const *port_name, char const *device_addr_str, TR_CAEN_Backend *backend,
+    TR_CAEN_LinkScheduler *link_scheduler, TRWorkerThread *shared_worker,
     int read_thread_prio_epics, int read_thread_stack_size,
     int max_ad_buffers, size_t max_ad_memory)
 :
@@ -46,24 +52,63 @@ TR_CAEN::TR_CAEN (
         .set(&TRBaseConfig::read_thread_stack_size, read_thread_stack_size)
         .set(&TRBaseConfig::max_ad_buffers, max_ad_buffers)
         .set(&TRBaseConfig::max_ad_memory, max_ad_memory)
+        .set(&TRBaseConfig::supports_pre_samples, true)
     ),
-    m_worker((std::string("TRwork:") + port_name)),
+    m_worker((shared_worker != NULL) ? shared_worker : new TRWorkerThread(std::string("TRwork:") + port_name)),
     m_device_addr_str(device_addr_str),
     m_open_state(OpenStateClosed),
     m_resetting(false),
     m_calibrating(false),
-    m_refreshing(false)
+    m_refreshing(false),
+    m_backend(backend),
+    m_readout_buffers_allocated(false),
+    m_readout_current(NULL),
+    m_readout_event_offset(0),
+    m_readout_next_offset(0),
+    m_interrupt_reading(false),
+    m_link_scheduler(link_scheduler),
+    m_link_reader_running(false),
+    m_link_reader_use_irq(false),
+    m_link_events_per_blt(1),
+    m_link_pending_events(0),
+    m_link_reader_stop(0),
+    m_link_reader_error(0),
+    m_link_memory_full(0),
+    m_link_events_stored(0),
+    m_burst_id(0),
+    m_acq_start_time(0.0),
+    m_time_tag_ambiguous(false),
+    m_continuous(false),
+    m_digitizer_running(false),
+    m_unpack_kernel(TR_CAEN_GetBestUnpackKernel()),
+    m_record_length(0),
+    m_num_post_samples(0),
+    m_decimation_exponent(0),
+    m_zle_mode(ZleModeOff),
+    m_channel_enable_mask(0),
+    m_raw_recorder((std::string("TRrec:") + port_name), epicsThreadPriorityLow,
+        epicsThreadGetStackSize(epicsThreadStackMedium)),
+    m_raw_recording(0),
+    m_raw_record_seq(0),
+    m_reg_stats_prev_time(TR_CAEN_RegisterStats::now())
 {
     char param_name[40];
     
     // Initialize worker thread tasks.
     for (int task = 0; task < NumWorkerTasks; task++) {
-        m_worker_task[task].init(&m_worker, this, (WorkerTask)task);
+        m_worker_task[task].init(m_worker, this, (WorkerTask)task);
     }
     
     // Non-channel-specific configuration parameters.
     initConfigParam(m_param_start_stop_mode,      "START_STOP_MODE",      -1);
+    initConfigParam(m_param_events_per_blt,       "EVENTS_PER_BLT",       -1);
     initConfigParam(m_param_run_start_stop_delay, "RUN_START_STOP_DELAY", (double)NAN);
+    initConfigParam(m_param_sample_format,        "SAMPLE_FORMAT",        -1);
+    initConfigParam(m_param_irq_level,            "IRQ_LEVEL",            -1);
+    initConfigParam(m_param_irq_event_number,     "IRQ_EVENT_NUMBER",     -1);
+    initConfigParam(m_param_zle_mode,             "ZLE_MODE",             -1);
+    initConfigParam(m_param_zle_polarity,         "ZLE_POLARITY",         -1);
+    initConfigParam(m_param_continuous,           "CONTINUOUS",           -1);
     
     // Channel-specific configuration parameters.
     for (int ch = 0; ch < MaxNumChannels; ch++) {
@@ -71,10 +116,14 @@ TR_CAEN::TR_CAEN (
         ::sprintf(ch_prefix_arr, "CH%d_", ch);
         std::string ch_prefix(ch_prefix_arr);
         
+        initConfigParam(m_param_channel[ch].enable,      (ch_prefix+"ENABLE").c_str(),      -1);
         initConfigParam(m_param_channel[ch].input_range, (ch_prefix+"INPUT_RANGE").c_str(), -1);
         initConfigParam(m_param_channel[ch].pulse_width, (ch_prefix+"PULSE_WIDTH").c_str(), (double)NAN);
+        initConfigParam(m_param_channel[ch].zle_threshold,  (ch_prefix+"ZLE_THRESHOLD").c_str(),  -1);
+        initConfigParam(m_param_channel[ch].zle_look_back,  (ch_prefix+"ZLE_LOOK_BACK").c_str(),  -1);
+        initConfigParam(m_param_channel[ch].zle_look_ahead, (ch_prefix+"ZLE_LOOK_AHEAD").c_str(), -1);
     }
-
+    
     // NOTE: All initConfigParam/initInternalParam must be before all createParam
     // so that the parameter index comparison in writeInt32/readInt32 works as expected.
     
@@ -111,6 +160,31 @@ TR_CAEN::TR_CAEN (
         createParam(param_name, asynParamInt32, &m_asyn_params[CH_SELF_TRIGGER_01_RB+i]);
     }
     
+    createParam("ACQ_RUNNING",    asynParamInt32, &m_asyn_params[ACQ_RUNNING]);
+    createParam("ACQ_EVENT_FULL", asynParamInt32, &m_asyn_params[ACQ_EVENT_FULL]);
+    createParam("PLL_LOCKED",     asynParamInt32, &m_asyn_params[PLL_LOCKED]);
+    createParam("BOARD_READY",    asynParamInt32, &m_asyn_params[BOARD_READY]);
+    createParam("EVENTS_STORED",  asynParamInt32, &m_asyn_params[EVENTS_STORED]);
+    for (int ch = 0; ch < MaxNumChannels; ch++) {
+        ::sprintf(param_name, "CH%d_TEMPERATURE", ch);
+        createParam(param_name, asynParamInt32, &m_asyn_params[CH_TEMPERATURE_FIRST+ch]);
+    }
+    
+    createParam("RECORD_RAW",         asynParamInt32,   &m_asyn_params[RECORD_RAW]);
+    createParam("RECORD_RAW_PATH",    asynParamOctet,   &m_asyn_params[RECORD_RAW_PATH]);
+    createParam("RECORD_RAW_BUFFERS", asynParamInt32,   &m_asyn_params[RECORD_RAW_BUFFERS]);
+    createParam("RECORD_RAW_STATE",   asynParamInt32,   &m_asyn_params[RECORD_RAW_STATE]);
+    createParam("RECORD_RAW_FILE",    asynParamOctet,   &m_asyn_params[RECORD_RAW_FILE]);
+    createParam("RECORD_RAW_MBYTES",  asynParamFloat64, &m_asyn_params[RECORD_RAW_MBYTES]);
+    createParam("RECORD_RAW_DROPPED", asynParamInt32,   &m_asyn_params[RECORD_RAW_DROPPED]);
+    
+    createParam("REG_OPS_RATE",    asynParamFloat64, &m_asyn_params[REG_OPS_RATE]);
+    createParam("REG_LATENCY_P99", asynParamFloat64, &m_asyn_params[REG_LATENCY_P99]);
+    createParam("REG_ERROR_RATE",  asynParamFloat64, &m_asyn_params[REG_ERROR_RATE]);
+    
+    createParam("REG_VERIFY_READBACKS", asynParamInt32, &m_asyn_params[REG_VERIFY_READBACKS]);
+    createParam("FORCE_FULL_ARM",       asynParamInt32, &m_asyn_params[FORCE_FULL_ARM]);
+    
     // Set initial parameter values.
     setIntegerParam(m_asyn_params[OPEN_STATE], m_open_state);
     setIntegerParam(m_asyn_params[RESET],      RequestStateFailed);
@@ -123,15 +197,58 @@ TR_CAEN::TR_CAEN (
     for (int i = 0; i < NumChannelPairs; i++) {
         setIntegerParam(m_asyn_params[CH_SELF_TRIGGER_01_RB+i], -1);
     }
+    for (int i = ACQ_RUNNING; i <= CH_TEMPERATURE_LAST; i++) {
+        setIntegerParam(m_asyn_params[i], -1);
+    }
+    setIntegerParam(m_asyn_params[RECORD_RAW],         0);
+    setStringParam(m_asyn_params[RECORD_RAW_PATH],     "");
+    setIntegerParam(m_asyn_params[RECORD_RAW_BUFFERS], 4);
+    setIntegerParam(m_asyn_params[RECORD_RAW_STATE],   RecordRawStateOff);
+    setStringParam(m_asyn_params[RECORD_RAW_FILE],     "");
+    setDoubleParam(m_asyn_params[RECORD_RAW_MBYTES],   0.0);
+    setIntegerParam(m_asyn_params[RECORD_RAW_DROPPED], 0);
+    setDoubleParam(m_asyn_params[REG_OPS_RATE],    0.0);
+    setDoubleParam(m_asyn_params[REG_LATENCY_P99], 0.0);
+    setDoubleParam(m_asyn_params[REG_ERROR_RATE],  0.0);
+    setIntegerParam(m_asyn_params[REG_VERIFY_READBACKS], 0);
+    setIntegerParam(m_asyn_params[FORCE_FULL_ARM],       0);
+    
+    m_reg_stats.getSnapshot(&m_reg_stats_prev);
+    
+    // Registers which are only changed by the driver are shadowed. AcqControl
+    // is not, since the library changes it when starting and stopping.
+    m_reg_cache.addRegister(Registers::FanSpeedControl);
+    m_reg_cache.addRegister(Registers::TriggerSourceEnableMask);
+    m_reg_cache.addRegister(Registers::RunStartStopDelay);
+    m_reg_cache.addRegister(Registers::ChannelEnableMask);
+    m_reg_cache.addRegister(Registers::DecimationFactor);
+    m_reg_cache.addRegister(Registers::PostTrigger);
+    for (int ch = 0; ch < MaxNumChannels; ch++) {
+        m_reg_cache.addRegister(Registers::ChannelGain[ch]);
+        m_reg_cache.addRegister(Registers::ChannelPulseWidth[ch]);
+    }
+    
+    asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, "%s Using %s sample unpack kernel.\n",
+        portName, m_unpack_kernel->name);
+    
+    // Initialize the readout buffers as not allocated.
+    for (size_t i = 0; i < NumReadoutBuffers; i++) {
+        ReadoutBuffer &rb = m_readout_ring.item(i);
+        rb.buffer = NULL;
+        rb.buffer_size = 0;
+        rb.data_words = 0;
+    }
     
-    // Start the worker thread.
-    m_worker.start();
+    // Start the worker thread, unless it is shared (then it is already started).
+    if (shared_worker == NULL) {
+        m_worker->start();
+    }
 }
 
 asynStatus TR_CAEN::writeInt32 (asynUser *pasynUser, int32_t value)
 {
     int reason = pasynUser->reason;
-
+    
     // If the parameter is not ours or a config parameter, delegate to base class
     if (reason < m_asyn_params[FIRST_PARAM]) {
         return TRBaseDriver::writeInt32(pasynUser, value);
@@ -143,7 +260,17 @@ asynStatus TR_CAEN::writeInt32 (asynUser *pasynUser, int32_t value)
     }
     
     // Handle parameters which are just written to the parameter cache.
-    if (reason == m_asyn_params[HW_SAMPLE_RATE]) {
+    if (reason == m_asyn_params[HW_SAMPLE_RATE] || reason == m_asyn_params[REG_VERIFY_READBACKS] ||
+        reason == m_asyn_params[FORCE_FULL_ARM] || reason == m_asyn_params[RECORD_RAW_BUFFERS])
+    {
+        return asynPortDriver::writeInt32(pasynUser, value);
+    }
+    
+    // Raw recording is started when arming, but it can be stopped at any time.
+    if (reason == m_asyn_params[RECORD_RAW]) {
+        if (value == 0) {
+            epicsAtomicSetIntT(&m_raw_recording, 0);
+        }
         return asynPortDriver::writeInt32(pasynUser, value);
     }
     
@@ -190,7 +317,7 @@ asynStatus TR_CAEN::writeInt32 (asynUser *pasynUser, int32_t value)
 asynStatus TR_CAEN::readInt32 (asynUser *pasynUser, int32_t *value)
 {
     int reason = pasynUser->reason;
-
+    
     // If the parameter is not ours or a config parameter, delegate to base class
     if (reason < m_asyn_params[FIRST_PARAM]) {
         return TRBaseDriver::readInt32(pasynUser, value);
@@ -445,16 +572,234 @@ void TR_CAEN::setOpenState (OpenState open_state)
     callParamCallbacks();
 }
 
+static void appendHeaderLine (std::string &header, char const *format, ...)
+{
+    char line[128];
+    va_list args;
+    va_start(args, format);
+    ::vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    header += line;
+}
+
+bool TR_CAEN::startRawRecording ()
+{
+    char const *function = "startRawRecording";
+    
+    int record_raw;
+    std::string path;
+    int num_buffers;
+    {
+        epicsGuard<asynPortDriver> lock(*this);
+        getIntegerParam(m_asyn_params[RECORD_RAW], &record_raw);
+        getStringParam(m_asyn_params[RECORD_RAW_PATH], path);
+        getIntegerParam(m_asyn_params[RECORD_RAW_BUFFERS], &num_buffers);
+    }
+    
+    if (!record_raw) {
+        return true;
+    }
+    
+    if (path.empty()) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s %s: RECORD_RAW_PATH is not set.\n",
+            portName, function);
+        return false;
+    }
+    
+    // The file name is the path prefix followed by the port name, the time
+    // of arming and a sequence number, so that quick rearming and other
+    // ports with the same path do not reuse a name. The recorder does not
+    // overwrite existing files.
+    epicsTimeStamp now;
+    epicsTimeGetCurrent(&now);
+    char time_str[40];
+    epicsTimeToStrftime(time_str, sizeof(time_str), "%Y%m%d_%H%M%S_%03f", &now);
+    char seq_str[16];
+    ::snprintf(seq_str, sizeof(seq_str), "%04u", m_raw_record_seq++);
+    std::string file_path = path + "_" + portName + "_" + time_str + "_" + seq_str + ".craw";
+    
+    // All readout buffers have the same size.
+    size_t max_record_size = m_readout_ring.item(0).buffer_size;
+    
+    if (!m_raw_recorder.open(file_path, rawRecordingHeader(), max_record_size, num_buffers)) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s %s: Failed to start recording to %s.\n",
+            portName, function, file_path.c_str());
+        
+        epicsGuard<asynPortDriver> lock(*this);
+        setIntegerParam(m_asyn_params[RECORD_RAW_STATE], RecordRawStateError);
+        callParamCallbacks();
+        return false;
+    }
+    
+    epicsAtomicSetIntT(&m_raw_recording, 1);
+    
+    {
+        epicsGuard<asynPortDriver> lock(*this);
+        setIntegerParam(m_asyn_params[RECORD_RAW_STATE], RecordRawStateRecording);
+        setStringParam(m_asyn_params[RECORD_RAW_FILE], file_path.c_str());
+        updateRawRecordingStatus(false);
+        callParamCallbacks();
+    }
+    
+    return true;
+}
+
+void TR_CAEN::stopRawRecording ()
+{
+    // Called when the link reader is stopped, so nothing is being written.
+    epicsAtomicSetIntT(&m_raw_recording, 0);
+    
+    if (!m_raw_recorder.isOpen()) {
+        return;
+    }
+    
+    bool success = m_raw_recorder.close();
+    if (!success) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s stopRawRecording: There were errors writing the raw data.\n",
+            portName);
+    }
+    
+    {
+        epicsGuard<asynPortDriver> lock(*this);
+        updateRawRecordingStatus(true);
+        callParamCallbacks();
+    }
+}
+
+std::string TR_CAEN::rawRecordingHeader ()
+{
+    std::string header;
+    
+    // Information about the digitizer.
+    {
+        epicsGuard<asynPortDriver> lock(*this);
+        
+        std::string str_value;
+        int int_value;
+        
+        appendHeaderLine(header, "port=%s\n", portName);
+        appendHeaderLine(header, "device_addr=%s\n", m_device_addr_str.c_str());
+        getStringParam(m_asyn_params[INFO_MODEL_NAME], str_value);
+        appendHeaderLine(header, "model_name=%s\n", str_value.c_str());
+        getStringParam(m_asyn_params[INFO_ROC_FW_REV], str_value);
+        appendHeaderLine(header, "roc_fw_rev=%s\n", str_value.c_str());
+        getStringParam(m_asyn_params[INFO_AMC_FW_REV], str_value);
+        appendHeaderLine(header, "amc_fw_rev=%s\n", str_value.c_str());
+        getIntegerParam(m_asyn_params[INFO_PCB_REVISION], &int_value);
+        appendHeaderLine(header, "pcb_revision=%d\n", int_value);
+        getIntegerParam(m_asyn_params[INFO_SERIAL_NUM], &int_value);
+        appendHeaderLine(header, "serial_number=%d\n", int_value);
+        getIntegerParam(m_asyn_params[INFO_NUM_CHANNELS], &int_value);
+        appendHeaderLine(header, "num_channels=%d\n", int_value);
+        getIntegerParam(m_asyn_params[INFO_FAMILY], &int_value);
+        appendHeaderLine(header, "family=%d\n", int_value);
+        getIntegerParam(m_asyn_params[INFO_CH_MEM_SIZE], &int_value);
+        appendHeaderLine(header, "ch_mem_size=%d\n", int_value);
+        
+        double hw_sample_rate;
+        getDoubleParam(m_asyn_params[HW_SAMPLE_RATE], &hw_sample_rate);
+        appendHeaderLine(header, "hw_sample_rate=%.17g\n", hw_sample_rate);
+    }
+    
+    // The armed configuration.
+    appendHeaderLine(header, "sample_rate=%.17g\n", getAchievableSampleRateSnapshot());
+    appendHeaderLine(header, "decimation_exponent=%d\n", m_decimation_exponent);
+    appendHeaderLine(header, "record_length=%d\n", m_record_length);
+    appendHeaderLine(header, "pre_samples=%d\n", getNumPreSamplesSnapshot());
+    appendHeaderLine(header, "post_samples=%d\n", m_num_post_samples);
+    appendHeaderLine(header, "start_stop_mode=%d\n", m_param_start_stop_mode.getSnapshot());
+    appendHeaderLine(header, "events_per_blt=%d\n", m_param_events_per_blt.getSnapshot());
+    appendHeaderLine(header, "zle_mode=%d\n", m_param_zle_mode.getSnapshot());
+    appendHeaderLine(header, "zle_polarity=%d\n", m_param_zle_polarity.getSnapshot());
+    appendHeaderLine(header, "channel_enable_mask=0x%02x\n", (unsigned int)m_channel_enable_mask);
+    
+    for (int ch = 0; ch < MaxNumChannels; ch++) {
+        if (!TR_CAEN_GetBit(m_channel_enable_mask, ch)) {
+            continue;
+        }
+        appendHeaderLine(header, "ch%d_input_range=%d\n", ch, m_param_channel[ch].input_range.getSnapshot());
+        appendHeaderLine(header, "ch%d_pulse_width=%d\n", ch, (int)m_param_channel[ch].pulse_width.getSnapshot());
+        appendHeaderLine(header, "ch%d_zle_threshold=%d\n", ch, m_param_channel[ch].zle_threshold.getSnapshot());
+        appendHeaderLine(header, "ch%d_zle_look_back=%d\n", ch, m_param_channel[ch].zle_look_back.getSnapshot());
+        appendHeaderLine(header, "ch%d_zle_look_ahead=%d\n", ch, m_param_channel[ch].zle_look_ahead.getSnapshot());
+    }
+    
+    return header;
+}
+
+void TR_CAEN::updateRawRecordingStatus (bool stopped)
+{
+    // Must be called with the port locked.
+    
+    setDoubleParam(m_asyn_params[RECORD_RAW_MBYTES], m_raw_recorder.getBytesWritten() / 1e6);
+    setIntegerParam(m_asyn_params[RECORD_RAW_DROPPED], m_raw_recorder.getRecordsDropped());
+    
+    RecordRawState state = m_raw_recorder.hadError() ? RecordRawStateError :
+        stopped ? RecordRawStateOff : RecordRawStateRecording;
+    setIntegerParam(m_asyn_params[RECORD_RAW_STATE], state);
+}
+
+void TR_CAEN::registerReport (FILE *out, bool reset)
+{
+    fprintf(out, "%s register access statistics:\n", portName);
+    m_reg_stats.report(out, m_error_codes);
+    
+    if (reset) {
+        m_reg_stats.reset();
+    }
+}
+
+void TR_CAEN::updateRegisterStats ()
+{
+    // Must be called with the port locked.
+    
+    TR_CAEN_RegisterStats::Snapshot snapshot;
+    m_reg_stats.getSnapshot(&snapshot);
+    uint64_t now = TR_CAEN_RegisterStats::now();
+    
+    double interval = (now - m_reg_stats_prev_time) / 1e9;
+    
+    // If the statistics were reset since the previous update, the current
+    // totals are the accesses in the interval.
+    bool was_reset = snapshot.ops < m_reg_stats_prev.ops || snapshot.errors < m_reg_stats_prev.errors;
+    size_t ops = was_reset ? snapshot.ops : (snapshot.ops - m_reg_stats_prev.ops);
+    size_t errors = was_reset ? snapshot.errors : (snapshot.errors - m_reg_stats_prev.errors);
+    
+    if (interval > 0.0) {
+        setDoubleParam(m_asyn_params[REG_OPS_RATE], ops / interval);
+        setDoubleParam(m_asyn_params[REG_ERROR_RATE], errors / interval);
+    }
+    setDoubleParam(m_asyn_params[REG_LATENCY_P99],
+        TR_CAEN_RegisterStats::getLatencyPercentile(m_reg_stats_prev, snapshot, 0.99) / 1e3);
+    
+    m_reg_stats_prev = snapshot;
+    m_reg_stats_prev_time = now;
+}
+
 void TR_CAEN::requestedSampleRateChanged ()
 {
-    // The hardware does not support adjustment of the sample rate.
-    // Just resport what the sample rate is, as we were told via the
-    // HW_SAMPLE_RATE parameter.
+    // The hardware samples at a fixed rate, which we are told via the
+    // HW_SAMPLE_RATE parameter. Lower rates are achieved by decimation
+    // with a power-of-two factor, choose the nearest one.
+    
+    double hw_sample_rate;
+    getDoubleParam(m_asyn_params[HW_SAMPLE_RATE], &hw_sample_rate);
+    
+    int exponent = decimationExponentForRate(hw_sample_rate, getRequestedSampleRate());
+    
+    setAchievableSampleRate(std::ldexp(hw_sample_rate, -exponent));
+}
+
+int TR_CAEN::decimationExponentForRate (double hw_sample_rate, double sample_rate)
+{
+    if (!(hw_sample_rate > 0.0 && sample_rate > 0.0)) {
+        return 0;
+    }
     
-    double sample_rate;
-    getDoubleParam(m_asyn_params[HW_SAMPLE_RATE], &sample_rate);
+    // Nearest on a logarithmic scale.
+    double exponent = std::floor(std::log(hw_sample_rate / sample_rate) / std::log(2.0) + 0.5);
     
-    setAchievableSampleRate(sample_rate);
+    return (int)std::max(0.0, std::min((double)MaxDecimationExponent, exponent));
 }
 
 bool TR_CAEN::waitForPreconditions ()
@@ -497,6 +842,14 @@ bool TR_CAEN::checkSettings (TRArmInfo &arm_info)
         return false;
     }
     
+    // Check the number of events per block transfer.
+    int events_per_blt = m_param_events_per_blt.getSnapshot();
+    if (!(events_per_blt >= 1 && events_per_blt <= MaxEventsPerBlt)) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s checkSettings: Invalid EVENTS_PER_BLT.\n",
+            portName);
+        return false;
+    }
+    
     // Check the run/start/stop delay.
     double delay = m_param_run_start_stop_delay.getSnapshot();
     if (!(delay >= 0 || delay <= std::numeric_limits<uint32_t>::max())) {
@@ -505,8 +858,69 @@ bool TR_CAEN::checkSettings (TRArmInfo &arm_info)
         return false;
     }
     
+    // Check the sample format.
+    int sample_format = m_param_sample_format.getSnapshot();
+    if (sample_format != SampleFormatRaw && sample_format != SampleFormatVolts) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s checkSettings: Invalid SAMPLE_FORMAT.\n",
+            portName);
+        return false;
+    }
+    
+    // Check the interrupt settings.
+    int irq_level = m_param_irq_level.getSnapshot();
+    if (!(irq_level >= 0 && irq_level <= MaxIrqLevel)) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s checkSettings: Invalid IRQ_LEVEL.\n",
+            portName);
+        return false;
+    }
+    
+    int irq_event_number = m_param_irq_event_number.getSnapshot();
+    if (!(irq_event_number >= 1 && irq_event_number <= MaxEventsPerBlt)) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s checkSettings: Invalid IRQ_EVENT_NUMBER.\n",
+            portName);
+        return false;
+    }
+    
+    // Check the ZLE settings.
+    int zle_mode = m_param_zle_mode.getSnapshot();
+    if (zle_mode != ZleModeOff && zle_mode != ZleModeSparse && zle_mode != ZleModeZeroFilled) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s checkSettings: Invalid ZLE_MODE.\n",
+            portName);
+        return false;
+    }
+    
+    int zle_polarity = m_param_zle_polarity.getSnapshot();
+    if (zle_polarity != ZlePolarityPositive && zle_polarity != ZlePolarityNegative) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s checkSettings: Invalid ZLE_POLARITY.\n",
+            portName);
+        return false;
+    }
+    
+    // Check the continuous mode setting.
+    int continuous = m_param_continuous.getSnapshot();
+    if (continuous != 0 && continuous != 1) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s checkSettings: Invalid CONTINUOUS.\n",
+            portName);
+        return false;
+    }
+    
     // Check channel-specific settings.
+    int num_enabled_channels = 0;
     for (int ch = 0; ch < MaxNumChannels; ch++) {
+        // Check the enable setting.
+        int enable = m_param_channel[ch].enable.getSnapshot();
+        if (enable != 0 && enable != 1) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s checkSettings: Invalid CH%d_ENABLE.\n",
+                portName, ch);
+            return false;
+        }
+        
+        // Other settings of disabled channels are not used.
+        if (!enable) {
+            continue;
+        }
+        num_enabled_channels++;
+        
         // Check the input range.
         int input_range = m_param_channel[ch].input_range.getSnapshot();
         if (input_range != InputRange2V && input_range != InputRange05V) {
@@ -522,12 +936,73 @@ bool TR_CAEN::checkSettings (TRArmInfo &arm_info)
                 portName, ch);
             return false;
         }
+        
+        // ZLE settings are only used in ZLE mode.
+        if (zle_mode == ZleModeOff) {
+            continue;
+        }
+        
+        // Check the ZLE threshold.
+        int zle_threshold = m_param_channel[ch].zle_threshold.getSnapshot();
+        if (!(zle_threshold >= 0 && zle_threshold <= MaxZleThreshold)) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s checkSettings: Invalid CH%d_ZLE_THRESHOLD.\n",
+                portName, ch);
+            return false;
+        }
+        
+        // Check the ZLE look-back and look-ahead windows (in samples).
+        int zle_look_back = m_param_channel[ch].zle_look_back.getSnapshot();
+        if (!(zle_look_back >= 0 && zle_look_back <= MaxZleWindowUnits * ZleWindowUnitSamples)) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s checkSettings: Invalid CH%d_ZLE_LOOK_BACK.\n",
+                portName, ch);
+            return false;
+        }
+        
+        int zle_look_ahead = m_param_channel[ch].zle_look_ahead.getSnapshot();
+        if (!(zle_look_ahead >= 0 && zle_look_ahead <= MaxZleWindowUnits * ZleWindowUnitSamples)) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s checkSettings: Invalid CH%d_ZLE_LOOK_AHEAD.\n",
+                portName, ch);
+            return false;
+        }
+    }
+    
+    // At least one channel needs to be enabled.
+    if (num_enabled_channels == 0) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s checkSettings: No channel is enabled.\n",
+            portName);
+        return false;
     }
     
+    // Determine the decimation corresponding to the achievable sample rate.
+    double hw_sample_rate;
+    getDoubleParam(m_asyn_params[HW_SAMPLE_RATE], &hw_sample_rate);
+    m_decimation_exponent = decimationExponentForRate(hw_sample_rate, getAchievableSampleRateSnapshot());
+    
     // Return the sample rate for display.
     arm_info.rate_for_display = getAchievableSampleRateSnapshot();
     
-    // TODO: Check for too large number of post samples.
+    // Determine the record length, which includes the pre-trigger samples.
+    // It is rounded up to the required granularity by adding post samples.
+    int num_pre_samples = getNumPreSamplesSnapshot();
+    int num_post_samples = getNumPostSamplesSnapshot();
+    int64_t record_length = (int64_t)num_pre_samples + num_post_samples;
+    int64_t remainder = record_length % RecordLengthGranularity;
+    if (remainder != 0) {
+        num_post_samples += RecordLengthGranularity - remainder;
+        record_length += RecordLengthGranularity - remainder;
+    }
+    
+    // Check that the record fits into the channel memory.
+    int ch_mem_size;
+    getIntegerParam(m_asyn_params[INFO_CH_MEM_SIZE], &ch_mem_size);
+    if (record_length <= 0 || record_length > ch_mem_size) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s checkSettings: Record length %lld is not within the channel memory size (%d).\n",
+            portName, (long long)record_length, ch_mem_size);
+        return false;
+    }
+    
+    m_record_length = record_length;
+    m_num_post_samples = num_post_samples;
     
     return true;
 }
@@ -542,91 +1017,595 @@ bool TR_CAEN::startAcquisition (bool had_overflow)
     // Sync with other code that modifies the AcqControl register.
     epicsGuard<epicsMutex> lock(m_acq_control_mutex);
     
-    err = CAEN_DGTZ_SetAcquisitionMode(m_dev_handle, (CAEN_DGTZ_AcqMode_t)m_param_start_stop_mode.getSnapshot());
-    if (err != CAEN_DGTZ_Success) {
-        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s %s: SetAcquisitionMode failed with error %d: %s.\n",
-            portName, function, (int)err, m_error_codes.getErrorText(err));
-        return false;
+    // Settings which are the same as applied at the previous arm are not
+    // applied again, unless a full arm is requested.
+    int force_full_arm;
+    {
+        epicsGuard<asynPortDriver> lock(*this);
+        getIntegerParam(m_asyn_params[FORCE_FULL_ARM], &force_full_arm);
+    }
+    if (force_full_arm) {
+        invalidateAppliedConfig();
+    }
+    
+    // If the digitizer was left running by a continuous acquisition, it is
+    // stopped before applying any setting (see stopDigitizerIfRunning calls
+    // here and in the register write functions). Otherwise it is not
+    // restarted and the events stored in the meantime are read out.
+    // This is only done if this acquisition is continuous too, a normal
+    // acquisition must not get events from before it was armed.
+    bool continuous = m_param_continuous.getSnapshot();
+    if (!continuous) {
+        stopDigitizerIfRunning();
+    }
+    
+    int acq_mode = m_param_start_stop_mode.getSnapshot();
+    if (m_applied_acq_mode.needsApply(acq_mode)) {
+        stopDigitizerIfRunning();
+        m_applied_acq_mode.invalidate();
+        err = m_backend->setAcquisitionMode((CAEN_DGTZ_AcqMode_t)acq_mode);
+        if (err != CAEN_DGTZ_Success) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s %s: SetAcquisitionMode failed with error %d: %s.\n",
+                portName, function, (int)err, m_error_codes.getErrorText(err));
+            return false;
+        }
+        m_applied_acq_mode.setApplied(acq_mode);
+    }
+    
+    if (m_applied_record_length.needsApply(m_record_length)) {
+        stopDigitizerIfRunning();
+        m_applied_record_length.invalidate();
+        err = m_backend->setRecordLength(m_record_length);
+        if (err != CAEN_DGTZ_Success) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s %s: SetRecordLength failed with error %d: %s.\n",
+                portName, function, (int)err, m_error_codes.getErrorText(err));
+            return false;
+        }
+        m_applied_record_length.setApplied(m_record_length);
     }
     
-    uint32_t delay_int = m_param_run_start_stop_delay.getSnapshot();
-    if (!writeRegister(function, Registers::RunStartStopDelay, delay_int)) {
+    // The Post Trigger register determines how the record is split into
+    // pre-trigger and post-trigger samples.
+    uint32_t post_trigger_value = (m_num_post_samples + PostTriggerUnitSamples - 1) / PostTriggerUnitSamples;
+    
+    // Program the channel enable mask. Disabled channels are not digitized
+    // nor transferred, and this also reduces the size of the readout buffers.
+    m_channel_enable_mask = 0;
+    for (int ch = 0; ch < MaxNumChannels; ch++) {
+        TR_CAEN_SetBit(&m_channel_enable_mask, ch, isChannelEnabledSnapshot(ch));
+    }
+    
+    // Write the board registers in one batch.
+    TR_CAEN_Register const *board_regs[] = {
+        &Registers::RunStartStopDelay,
+        &Registers::DecimationFactor,
+        &Registers::PostTrigger,
+        &Registers::ChannelEnableMask
+    };
+    uint32_t board_values[] = {
+        (uint32_t)m_param_run_start_stop_delay.getSnapshot(),
+        (uint32_t)m_decimation_exponent,
+        post_trigger_value,
+        m_channel_enable_mask
+    };
+    if (!writeRegistersIfChanged(function, board_regs, 4, board_values)) {
         return false;
     }
     
-    int num_post_samples = getNumPostSamplesSnapshot();
-    int remainder = num_post_samples % 4;
-    if (remainder != 0) {
-        // Round up to a multiple of 4.
-        int incr = 4 - remainder;
-        num_post_samples += std::min(incr, std::numeric_limits<int>::max() - num_post_samples);
+    // Enable or disable zero length encoding, the per-channel ZLE
+    // parameters are programmed below.
+    m_zle_mode = m_param_zle_mode.getSnapshot();
+    bool zle = m_zle_mode != ZleModeOff;
+    bool zle_negative = m_param_zle_polarity.getSnapshot() == ZlePolarityNegative;
+    
+    if (m_applied_zs_mode.needsApply(zle)) {
+        // The library may reprogram the channel ZLE parameters too.
+        stopDigitizerIfRunning();
+        m_applied_zs_mode.invalidate();
+        for (int ch = 0; ch < MaxNumChannels; ch++) {
+            m_applied_zs_params[ch].invalidate();
+            m_applied_zle_negative[ch].invalidate();
+        }
+        
+        err = m_backend->setZeroSuppressionMode(zle ? CAEN_DGTZ_ZS_ZLE : CAEN_DGTZ_ZS_NO);
+        if (err != CAEN_DGTZ_Success) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s %s: SetZeroSuppressionMode failed with error %d: %s.\n",
+                portName, function, (int)err, m_error_codes.getErrorText(err));
+            return false;
+        }
+        m_applied_zs_mode.setApplied(zle);
     }
     
-    err = CAEN_DGTZ_SetRecordLength(m_dev_handle, num_post_samples);
-    if (err != CAEN_DGTZ_Success) {
-        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s %s: SetRecordLength failed with error %d: %s.\n",
-            portName, function, (int)err, m_error_codes.getErrorText(err));
+    // Determine the gain and pulse width register values of the enabled
+    // channels, then write them for all channels at once if possible.
+    uint32_t gain_values[MaxNumChannels];
+    uint32_t pulse_width_values[MaxNumChannels];
+    
+    for (int ch = 0; ch < MaxNumChannels; ch++) {
+        if (!TR_CAEN_GetBit(m_channel_enable_mask, ch)) {
+            continue;
+        }
+        
+        bool range_05v = m_param_channel[ch].input_range.getSnapshot() == InputRange05V;
+        
+        // Full scale of 2^14 codes spans the input range, centered at zero.
+        float range_volts = range_05v ? 0.5f : 2.0f;
+        m_volts_conversion[ch].scale = range_volts / 16384.0f;
+        m_volts_conversion[ch].offset = -range_volts / 2.0f;
+        
+        gain_values[ch] = range_05v;
+        
+        // Only the low 8 bits of the pulse width register are ours.
+        if (!readRegisterCached(function, Registers::ChannelPulseWidth[ch], &pulse_width_values[ch], false)) {
+            return false;
+        }
+        TR_CAEN_SetBits(&pulse_width_values[ch], 0, 8, (uint32_t)m_param_channel[ch].pulse_width.getSnapshot());
+    }
+    
+    if (!writeChannelRegisters(function, Registers::ChannelGain, Registers::ChannelGainBroadcast,
+                               gain_values, m_channel_enable_mask) ||
+        !writeChannelRegisters(function, Registers::ChannelPulseWidth, Registers::ChannelPulseWidthBroadcast,
+                               pulse_width_values, m_channel_enable_mask))
+    {
         return false;
     }
     
     for (int ch = 0; ch < MaxNumChannels; ch++) {
-        uint32_t gain_value = m_param_channel[ch].input_range.getSnapshot() == InputRange05V;
-        if (!writeRegister(function, Registers::ChannelGain[ch], gain_value)) {
-            return false;
+        if (!TR_CAEN_GetBit(m_channel_enable_mask, ch)) {
+            continue;
         }
         
-        uint32_t pulse_width_value = m_param_channel[ch].pulse_width.getSnapshot();
-        if (!modifyRegister(function, Registers::ChannelPulseWidth[ch], 0, 8, pulse_width_value)) {
+        if (zle) {
+            // The windows are programmed in units of ZleWindowUnitSamples,
+            // rounding up so that at least the requested samples are kept.
+            uint32_t look_back_units = (m_param_channel[ch].zle_look_back.getSnapshot() + ZleWindowUnitSamples - 1) / ZleWindowUnitSamples;
+            uint32_t look_ahead_units = (m_param_channel[ch].zle_look_ahead.getSnapshot() + ZleWindowUnitSamples - 1) / ZleWindowUnitSamples;
+            int32_t nsamp = (look_back_units << 16) | look_ahead_units;
+            std::pair<int, int> zs_params(m_param_channel[ch].zle_threshold.getSnapshot(), nsamp);
+            
+            if (m_applied_zs_params[ch].needsApply(zs_params)) {
+                // This also rewrites the threshold polarity bit.
+                stopDigitizerIfRunning();
+                m_applied_zs_params[ch].invalidate();
+                m_applied_zle_negative[ch].invalidate();
+                
+                err = m_backend->setChannelZSParams(ch, CAEN_DGTZ_ZS_FINE, zs_params.first, zs_params.second);
+                if (err != CAEN_DGTZ_Success) {
+                    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s %s: SetChannelZSParams failed with error %d: %s.\n",
+                        portName, function, (int)err, m_error_codes.getErrorText(err));
+                    return false;
+                }
+                m_applied_zs_params[ch].setApplied(zs_params);
+            }
+            
+            // Select whether samples over or under the threshold are kept.
+            if (m_applied_zle_negative[ch].needsApply(zle_negative)) {
+                stopDigitizerIfRunning();
+                if (!modifyRegister(function, Registers::ChannelZleThreshold[ch], 31, 1, zle_negative)) {
+                    return false;
+                }
+                m_applied_zle_negative[ch].setApplied(zle_negative);
+            }
+        }
+    }
+    
+    // Set how many events one ReadData may transfer. Each event is still
+    // processed as a separate burst.
+    m_link_events_per_blt = m_param_events_per_blt.getSnapshot();
+    if (m_applied_events_per_blt.needsApply(m_link_events_per_blt)) {
+        stopDigitizerIfRunning();
+        m_applied_events_per_blt.invalidate();
+        err = m_backend->setMaxNumEventsBLT(m_link_events_per_blt);
+        if (err != CAEN_DGTZ_Success) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s %s: SetMaxNumEventsBLT failed with error %d: %s.\n",
+                portName, function, (int)err, m_error_codes.getErrorText(err));
+            return false;
+        }
+        m_applied_events_per_blt.setApplied(m_link_events_per_blt);
+    }
+    
+    // Configure interrupts, used by the link reader to wait for data.
+    // An interrupt is raised when at least IRQ_EVENT_NUMBER events are stored
+    // and released when the data is read (RORA).
+    int irq_level = m_param_irq_level.getSnapshot();
+    int irq_event_number = m_param_irq_event_number.getSnapshot();
+    bool use_irq = irq_level > 0;
+    
+    // The event number does not matter with interrupts disabled. Unlike the
+    // settings above, this can be changed while the digitizer is running,
+    // which is needed when resuming since the interrupt is disabled when
+    // disarming.
+    std::pair<int, int> irq_config(irq_level, use_irq ? irq_event_number : 0);
+    if (m_applied_irq_config.needsApply(irq_config)) {
+        m_applied_irq_config.invalidate();
+        err = m_backend->setInterruptConfig(
+            use_irq ? CAEN_DGTZ_ENABLE : CAEN_DGTZ_DISABLE, irq_level, IrqStatusId,
+            irq_event_number, CAEN_DGTZ_IRQ_MODE_RORA);
+        if (err != CAEN_DGTZ_Success) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s %s: SetInterruptConfig failed with error %d: %s.\n",
+                portName, function, (int)err, m_error_codes.getErrorText(err));
             return false;
         }
+        m_applied_irq_config.setApplied(irq_config);
     }
+    m_link_reader_use_irq = use_irq;
     
-    err = CAEN_DGTZ_SWStartAcquisition(m_dev_handle);
-    if (err != CAEN_DGTZ_Success) {
-        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s %s: SWStartAcquisition failed with error %d: %s.\n",
-            portName, function, (int)err, m_error_codes.getErrorText(err));
+    m_continuous = continuous;
+    
+    // If the digitizer is still running, the readout continues where it was
+    // stopped, including the data already transferred into the readout ring.
+    bool resume = m_digitizer_running;
+    
+    // Allocate the readout buffers when arming. The required size depends on
+    // the settings above. When restarting after an overflow the settings are
+    // the same and the existing buffers are reused.
+    if (!resume && (!had_overflow || !m_readout_buffers_allocated)) {
+        if (!allocateReadoutBuffers()) {
+            return false;
+        }
+        m_burst_id = 0;
+    }
+    
+    // Start recording the raw data if requested.
+    if (!startRawRecording()) {
         return false;
     }
     
+    // Discard any data left over from before.
+    if (!resume) {
+        m_readout_ring.reset();
+        m_readout_current = NULL;
+        m_readout_event_offset = 0;
+        m_readout_next_offset = 0;
+    }
+    
+    {
+        epicsGuard<asynPortDriver> lock(*this);
+        m_interrupt_reading = false;
+    }
+    
+    if (!resume) {
+        // The trigger time tags count from the start of the acquisition.
+        m_time_tag_extender.reset();
+        epicsTimeStamp start_time;
+        epicsTimeGetCurrent(&start_time);
+        m_acq_start_time = start_time.secPastEpoch + start_time.nsec / 1e9;
+        
+        err = m_backend->swStartAcquisition();
+        if (err != CAEN_DGTZ_Success) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s %s: SWStartAcquisition failed with error %d: %s.\n",
+                portName, function, (int)err, m_error_codes.getErrorText(err));
+            stopRawRecording();
+            return false;
+        }
+        m_digitizer_running = true;
+    }
+    
+    // Start transferring data from the digitizer.
+    startLinkReader();
+    
     return true;
 }
 
-#if 0
 bool TR_CAEN::readBurst ()
 {
-    // TODO
-    return false;
+    char const *function = "readBurst";
+    
+    if (m_readout_current != NULL) {
+        // If events from the current buffer remain, continue with the next one.
+        if (m_readout_next_offset < m_readout_current->data_words) {
+            m_readout_event_offset = m_readout_next_offset;
+            return true;
+        }
+        
+        // Done with this buffer, give it back to the link reader.
+        m_readout_ring.consume();
+        m_readout_current = NULL;
+        m_link_scheduler->wakeup();
+    }
+    
+    while (true) {
+        // Check if reading has been interrupted.
+        {
+            epicsGuard<asynPortDriver> lock(*this);
+            if (m_interrupt_reading) {
+                return false;
+            }
+        }
+        
+        // Take the next buffer filled by the link reader, if any.
+        // The events are decoded one by one in processBurstData.
+        ReadoutBuffer *rb = m_readout_ring.consumerItem();
+        if (rb != NULL) {
+            m_readout_current = rb;
+            m_readout_event_offset = 0;
+            m_readout_next_offset = 0;
+            return true;
+        }
+        
+        // Stop if the link reader failed.
+        if (epicsAtomicGetIntT(&m_link_reader_error)) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s %s: Link reader stopped due to an error.\n",
+                portName, function);
+            return false;
+        }
+        
+        // Wait for the link reader or an interrupt.
+        m_read_wakeup.wait();
+    }
 }
 
 bool TR_CAEN::checkOverflow (bool* had_overflow, int *num_buffer_bursts)
 {
-    // TODO
-    return false;
+    // The acquisition status is read by the link reader along with the data
+    // transfers, here we only pick up what it found, so checking for overflow
+    // does not cost link transactions.
+    bool memory_full = epicsAtomicCmpAndSwapIntT(&m_link_memory_full, 1, 0) == 1;
+    int events_stored = epicsAtomicGetIntT(&m_link_events_stored);
+    
+    if (memory_full) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_WARNING, "%s checkOverflow: Digitizer memory was full, triggers may have been lost.\n",
+            portName);
+    }
+    
+    // In continuous mode the digitizer is not restarted, it stores events
+    // again as soon as the readout frees memory.
+    *had_overflow = memory_full && !m_continuous;
+    *num_buffer_bursts = events_stored;
+    
+    return true;
 }
 
 bool TR_CAEN::processBurstData ()
 {
-    // TODO
-    return false;
-}
-
-void TR_CAEN::interruptReading ()
-{
-    // TODO
-}
-#endif
-
-void TR_CAEN::stopAcquisition ()
+    char const *function = "processBurstData";
+    
+    // Decode the header of the current event in the readout buffer.
+    uint32_t const *event_data = (uint32_t const *)m_readout_current->buffer + m_readout_event_offset;
+    size_t avail_words = m_readout_current->data_words - m_readout_event_offset;
+    
+    TR_CAEN_EventHeader header;
+    if (!TR_CAEN_DecodeEventHeader(event_data, avail_words, &header)) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s %s: Invalid event header in readout data.\n",
+            portName, function);
+        return false;
+    }
+    
+    m_readout_next_offset = m_readout_event_offset + header.size_words;
+    
+    size_t num_samples = TR_CAEN_EventNumSamples(header);
+    
+    bool volts = m_param_sample_format.getSnapshot() == SampleFormatVolts;
+    
+    epicsTimeStamp now;
+    epicsTimeGetCurrent(&now);
+    double timestamp = now.secPastEpoch + now.nsec / 1e9;
+    
+    // The events are processed in order, so the time tag can be extended.
+    // The host time helps to find rollovers in long gaps between events,
+    // unless the time tags are not in real time (replay).
+    double elapsed_time = m_backend->timeTagsFollowHostTime() ? std::max(0.0, timestamp - m_acq_start_time) : -1.0;
+    uint64_t time_tag = m_time_tag_extender.extend(header.trigger_time_tag, elapsed_time, &m_time_tag_ambiguous);
+    
+    // Unpack the data of each channel present in the event directly into
+    // the NDArray. The channel blocks follow the header in channel order.
+    uint32_t const *ch_data = event_data + TR_CAEN_EventHeaderWords;
+    uint32_t const *event_end = event_data + header.size_words;
+    size_t ch_words = num_samples / 2;
+    
+    for (int ch = 0; ch < MaxNumChannels; ch++) {
+        if (!TR_CAEN_GetBit(header.channel_mask, ch)) {
+            continue;
+        }
+        
+        // In ZLE format, each channel block has its own size and consists of
+        // stored segments, otherwise all channel blocks are the same size.
+        size_t record_samples = 0;
+        if (header.zle) {
+            if (!TR_CAEN_DecodeZleChannel(ch_data, event_end - ch_data, m_zle_segments, &ch_words, &record_samples)) {
+                asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s %s: Invalid ZLE data for channel %d.\n",
+                    portName, function, ch);
+                return false;
+            }
+        }
+        
+        uint32_t const *samples = ch_data;
+        ch_data += ch_words;
+        
+        // Only enabled channels should be present, but do not allocate
+        // arrays for anything else.
+        if (!TR_CAEN_GetBit(m_channel_enable_mask, ch)) {
+            continue;
+        }
+        
+        if (header.zle) {
+            submitZleChannel(ch, volts, record_samples, header, time_tag, timestamp);
+            continue;
+        }
+        
+        TRChannelDataSubmit data_submit;
+        if (!data_submit.allocateArray(*this, ch, volts ? NDFloat32 : NDInt16, num_samples)) {
+            continue;
+        }
+        
+        if (volts) {
+            m_unpack_kernel->unpack_scaled(samples, data_submit.data<epicsFloat32>(), num_samples,
+                                           m_volts_conversion[ch].scale, m_volts_conversion[ch].offset);
+        } else {
+            m_unpack_kernel->unpack(samples, data_submit.data<epicsInt16>(), num_samples);
+        }
+        
+        submitChannelArray(data_submit, ch, header, time_tag, timestamp);
+    }
+    
+    m_burst_id++;
+    
+    return true;
+}
+
+void TR_CAEN::submitZleChannel (int ch, bool volts, size_t record_samples, TR_CAEN_EventHeader const &header,
+                                uint64_t time_tag, double timestamp)
+{
+    NDDataType_t data_type = volts ? NDFloat32 : NDInt16;
+    float scale = m_volts_conversion[ch].scale;
+    float offset = m_volts_conversion[ch].offset;
+    
+    if (m_zle_mode == ZleModeSparse) {
+        // Publish each stored segment as a separate array, with attributes
+        // identifying its position within the record.
+        int num_segments = m_zle_segments.size();
+        for (int i = 0; i < num_segments; i++) {
+            TR_CAEN_ZleSegment const &segment = m_zle_segments[i];
+            
+            TRChannelDataSubmit data_submit;
+            if (!data_submit.allocateArray(*this, ch, data_type, segment.num_samples)) {
+                continue;
+            }
+            
+            if (volts) {
+                m_unpack_kernel->unpack_scaled(segment.data, data_submit.data<epicsFloat32>(), segment.num_samples, scale, offset);
+            } else {
+                m_unpack_kernel->unpack(segment.data, data_submit.data<epicsInt16>(), segment.num_samples);
+            }
+            
+            NDAttributeList *attrs = data_submit.getArray()->pAttributeList;
+            epicsInt32 segment_offset = segment.sample_offset;
+            epicsInt32 segment_index = i;
+            epicsInt32 record_length = record_samples;
+            attrs->add("ZleSegmentOffset", "Offset of the segment in the record (samples)", NDAttrInt32, &segment_offset);
+            attrs->add("ZleSegmentIndex", "Index of the segment in the record", NDAttrInt32, &segment_index);
+            attrs->add("ZleNumSegments", "Number of segments in the record", NDAttrInt32, &num_segments);
+            attrs->add("ZleRecordLength", "Length of the record (samples)", NDAttrInt32, &record_length);
+            
+            submitChannelArray(data_submit, ch, header, time_tag, timestamp);
+        }
+    } else {
+        // Publish the whole record with the skipped samples set to zero.
+        TRChannelDataSubmit data_submit;
+        if (!data_submit.allocateArray(*this, ch, data_type, record_samples)) {
+            return;
+        }
+        
+        size_t sample_size = volts ? sizeof(epicsFloat32) : sizeof(epicsInt16);
+        char *data = data_submit.data<char>();
+        ::memset(data, 0, record_samples * sample_size);
+        
+        for (size_t i = 0; i < m_zle_segments.size(); i++) {
+            TR_CAEN_ZleSegment const &segment = m_zle_segments[i];
+            if (volts) {
+                m_unpack_kernel->unpack_scaled(segment.data, (epicsFloat32 *)data + segment.sample_offset, segment.num_samples, scale, offset);
+            } else {
+                m_unpack_kernel->unpack(segment.data, (epicsInt16 *)data + segment.sample_offset, segment.num_samples);
+            }
+        }
+        
+        submitChannelArray(data_submit, ch, header, time_tag, timestamp);
+    }
+}
+
+void TR_CAEN::submitChannelArray (TRChannelDataSubmit &data_submit, int ch, TR_CAEN_EventHeader const &header,
+                                  uint64_t time_tag, double timestamp)
+{
+    // The unique ID of the array is only 32-bit, the full burst ID is
+    // attached as an attribute.
+    NDAttributeList *attrs = data_submit.getArray()->pAttributeList;
+    uint64_t burst_id = m_burst_id;
+    attrs->add("BurstId", "ID of the burst (event) since the acquisition was started", NDAttrUInt64, &burst_id);
+    
+    // Identify the event for event building across boards. The absolute
+    // trigger time is only as accurate as the start time taken by the IOC.
+    epicsUInt32 event_counter = header.event_counter;
+    double trigger_time = m_acq_start_time + time_tag / TR_CAEN_TimeTagFrequency;
+    attrs->add("TriggerTimeTag", "Trigger time tag (8 ns units since the acquisition was started)", NDAttrUInt64, &time_tag);
+    epicsInt32 time_tag_ambiguous = m_time_tag_ambiguous;
+    attrs->add("TriggerTimeTagAmbiguous", "Whether rollovers of the trigger time tag were estimated from the host time (1) or are certain (0)", NDAttrInt32, &time_tag_ambiguous);
+    attrs->add("EventCounter", "Event counter of the digitizer (24 bits)", NDAttrUInt32, &event_counter);
+    attrs->add("TriggerTime", "Trigger time (seconds since the EPICS epoch)", NDAttrFloat64, &trigger_time);
+    
+    data_submit.submit(*this, ch, (int)m_burst_id, timestamp);
+}
+
+void TR_CAEN::interruptReading ()
+{
+    // Make readBurst return as soon as possible.
+    m_interrupt_reading = true;
+    m_read_wakeup.signal();
+    
+    // Also make the link reader stop waiting for data, it will notice
+    // within IrqWaitTimeoutMs when waiting for an interrupt.
+    // It is fully stopped in stopAcquisition.
+    epicsAtomicSetIntT(&m_link_reader_stop, 1);
+    m_link_scheduler->wakeup();
+}
+
+void TR_CAEN::stopAcquisition ()
 {
     assert(m_open_state == OpenStateOpened);
     
-    CAEN_DGTZ_ErrorCode err;
+    // Stop transferring data before stopping the acquisition.
+    stopLinkReader();
+    
+    // Finish the raw recording, if any.
+    stopRawRecording();
+    
+    epicsGuard<epicsMutex> lock(m_acq_control_mutex);
+    
+    // In continuous mode the digitizer is left running, so that no events
+    // are lost until the next arm (unless its memory gets full). Only the
+    // interrupt is disabled, since nobody services it until then and the
+    // interrupt line is shared with the other digitizers on the link.
+    if (m_continuous) {
+        disableInterrupt();
+        return;
+    }
+    
+    stopDigitizer();
+}
+
+void TR_CAEN::disableInterrupt ()
+{
+    // Must be called with m_acq_control_mutex locked.
+    
+    if (!m_link_reader_use_irq) {
+        return;
+    }
     
-    err = CAEN_DGTZ_SWStopAcquisition(m_dev_handle);
+    CAEN_DGTZ_ErrorCode err = m_backend->setInterruptConfig(CAEN_DGTZ_DISABLE, 0, IrqStatusId, 1, CAEN_DGTZ_IRQ_MODE_RORA);
+    if (err != CAEN_DGTZ_Success) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s disableInterrupt: SetInterruptConfig failed with error %d: %s.\n",
+            portName, (int)err, m_error_codes.getErrorText(err));
+        m_applied_irq_config.invalidate();
+    } else {
+        m_applied_irq_config.setApplied(std::pair<int, int>(0, 0));
+    }
+    m_link_reader_use_irq = false;
+}
+
+void TR_CAEN::stopDigitizer ()
+{
+    // Must be called with m_acq_control_mutex locked.
+    
+    disableInterrupt();
+    
+    CAEN_DGTZ_ErrorCode err = m_backend->swStopAcquisition();
     if (err != CAEN_DGTZ_Success) {
         asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s stopAcquisition: SWStopAcquisition failed with error %d: %s.\n",
             portName, (int)err, m_error_codes.getErrorText(err));
     }
+    
+    m_digitizer_running = false;
+}
+
+void TR_CAEN::stopDigitizerIfRunning ()
+{
+    // Must be called with m_acq_control_mutex locked, when not armed. The
+    // digitizer can only be running if it was left running by a continuous
+    // acquisition.
+    
+    if (m_digitizer_running) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, "%s Stopping continuous acquisition left running.\n", portName);
+        stopDigitizer();
+    }
 }
 
 void TR_CAEN::runWorkerThreadTask (int id)
@@ -655,6 +1634,183 @@ void TR_CAEN::runWorkerThreadTask (int id)
     #undef TASK_CASE
 }
 
+TR_CAEN_LinkClient::StepResult TR_CAEN::linkReadoutStep ()
+{
+    char const *function = "linkReadoutStep";
+    CAEN_DGTZ_ErrorCode err;
+    
+    if (epicsAtomicGetIntT(&m_link_reader_stop) || epicsAtomicGetIntT(&m_link_reader_error)) {
+        return StepStopped;
+    }
+    
+    // Get a free buffer, the scheduler is woken up when the decoder releases one.
+    ReadoutBuffer *rb = m_readout_ring.producerItem();
+    if (rb == NULL) {
+        return StepBlocked;
+    }
+    
+    // Read whatever the digitizer has available into the buffer.
+    uint32_t data_size = 0;
+    err = m_backend->readData(rb->buffer, &data_size);
+    if (err != CAEN_DGTZ_Success) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s %s: ReadData failed with error %d: %s.\n",
+            portName, function, (int)err, m_error_codes.getErrorText(err));
+        stopLinkReaderOnError();
+        return StepStopped;
+    }
+    
+    // Count the events transferred to update the estimate of pending events.
+    // A transfer of fewer than the maximum number of events means that the
+    // digitizer had no more events at that time.
+    size_t data_words = data_size / sizeof(uint32_t);
+    int num_events = TR_CAEN_CountEvents((uint32_t const *)rb->buffer, data_words);
+    if (num_events < m_link_events_per_blt) {
+        m_link_pending_events = 0;
+    } else {
+        m_link_pending_events = std::max(1, m_link_pending_events - num_events);
+    }
+    
+    // Check the acquisition status every StatusCheckInterval, along
+    // with the data transfers rather than for every burst.
+    if (!checkLinkStatus()) {
+        stopLinkReaderOnError();
+        return StepStopped;
+    }
+    
+    if (data_words < (size_t)TR_CAEN_EventHeaderWords) {
+        return StepNoData;
+    }
+    
+    // Record the raw data if requested.
+    if (epicsAtomicGetIntT(&m_raw_recording)) {
+        m_raw_recorder.write(rb->buffer, data_words * sizeof(uint32_t));
+    }
+    
+    // Pass the buffer to the decoder.
+    rb->data_words = data_words;
+    m_readout_ring.produce();
+    m_read_wakeup.signal();
+    
+    return StepData;
+}
+
+int TR_CAEN::linkPendingEvents ()
+{
+    // Handle stop requests and errors promptly.
+    if (epicsAtomicGetIntT(&m_link_reader_stop) || epicsAtomicGetIntT(&m_link_reader_error)) {
+        return INT_MAX;
+    }
+    
+    // Nothing can be transferred without a free buffer.
+    if (m_readout_ring.producerItem() == NULL) {
+        return 0;
+    }
+    
+    return m_link_pending_events;
+}
+
+bool TR_CAEN::linkUsesIrq ()
+{
+    return m_link_reader_use_irq;
+}
+
+void TR_CAEN::linkWaitForIrq ()
+{
+    char const *function = "linkWaitForIrq";
+    
+    // Wait for the interrupt with a short timeout so that a stop request
+    // is noticed promptly.
+    CAEN_DGTZ_ErrorCode err = m_backend->irqWait(IrqWaitTimeoutMs);
+    if (err != CAEN_DGTZ_Success && err != CAEN_DGTZ_Timeout) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s %s: IRQWait failed with error %d: %s.\n",
+            portName, function, (int)err, m_error_codes.getErrorText(err));
+        stopLinkReaderOnError();
+    }
+}
+
+void TR_CAEN::linkReadoutStopped ()
+{
+    // Report that we have stopped.
+    m_link_reader_stopped.signal();
+}
+
+void TR_CAEN::stopLinkReaderOnError ()
+{
+    // Make readBurst report the error. The next linkReadoutStep returns
+    // StepStopped and the link scheduler removes us, so there are no more
+    // transfers until the link reader is started again.
+    epicsAtomicSetIntT(&m_link_reader_error, 1);
+    m_read_wakeup.signal();
+}
+
+bool TR_CAEN::checkLinkStatus ()
+{
+    char const *function = "checkLinkStatus";
+    
+    epicsTimeStamp now;
+    epicsTimeGetCurrent(&now);
+    
+    if (epicsTimeDiffInSeconds(&now, &m_link_status_check_time) < StatusCheckInterval) {
+        return true;
+    }
+    m_link_status_check_time = now;
+    
+    uint32_t acq_status;
+    if (!readRegister(function, Registers::AcqStatus, &acq_status)) {
+        return false;
+    }
+    
+    uint32_t events_stored;
+    if (!readRegister(function, Registers::EventStored, &events_stored)) {
+        return false;
+    }
+    
+    // Bit 4 of the acquisition status indicates that the memory is full.
+    // It is latched until checkOverflow picks it up.
+    if (TR_CAEN_GetBit(acq_status, 4)) {
+        epicsAtomicSetIntT(&m_link_memory_full, 1);
+    }
+    
+    int events_stored_int = std::min(events_stored, (uint32_t)INT_MAX);
+    epicsAtomicSetIntT(&m_link_events_stored, events_stored_int);
+    
+    // This is an exact count of the events not transferred yet.
+    m_link_pending_events = events_stored_int;
+    
+    return true;
+}
+
+void TR_CAEN::startLinkReader ()
+{
+    assert(!m_link_reader_running);
+    
+    epicsAtomicSetIntT(&m_link_reader_stop, 0);
+    epicsAtomicSetIntT(&m_link_reader_error, 0);
+    epicsAtomicSetIntT(&m_link_memory_full, 0);
+    epicsAtomicSetIntT(&m_link_events_stored, 0);
+    epicsTimeGetCurrent(&m_link_status_check_time);
+    m_link_pending_events = 0;
+    m_link_reader_stopped.tryWait();
+    
+    m_link_reader_running = true;
+    m_link_scheduler->activate(this);
+}
+
+void TR_CAEN::stopLinkReader ()
+{
+    if (!m_link_reader_running) {
+        return;
+    }
+    
+    // The link scheduler removes us and signals m_link_reader_stopped, or
+    // has done so already if the link reader stopped due to an error.
+    epicsAtomicSetIntT(&m_link_reader_stop, 1);
+    m_link_scheduler->wakeup();
+    m_link_reader_stopped.wait();
+    
+    m_link_reader_running = false;
+}
+
 void TR_CAEN::assertOpenFromWorker ()
 {
     // The open state was OpenStateOpened when the request was requested,
@@ -674,7 +1830,7 @@ void TR_CAEN::handleWorkerTaskOpenClose ()
     
     // Do the open/close.
     bool success = opening ? openDigitizer() : closeDigitizer();
-        
+    
     {
         epicsGuard<asynPortDriver> lock(*this);
         
@@ -714,8 +1870,13 @@ void TR_CAEN::handleWorkerTaskReset ()
     assert(m_resetting);
     assertOpenFromWorker();
     
+    {
+        epicsGuard<epicsMutex> lock(m_acq_control_mutex);
+        stopDigitizerIfRunning();
+    }
+    
     // Do the reset.
-    CAEN_DGTZ_ErrorCode ret = CAEN_DGTZ_Reset(m_dev_handle);
+    CAEN_DGTZ_ErrorCode ret = m_backend->reset();
     
     bool success = ret == CAEN_DGTZ_Success;
     if (!success) {
@@ -723,6 +1884,15 @@ void TR_CAEN::handleWorkerTaskReset ()
             portName, (int)ret, m_error_codes.getErrorText(ret));
     }
     
+    // The registers are back at their defaults, reload the register cache.
+    {
+        epicsGuard<epicsMutex> lock(m_acq_control_mutex);
+        invalidateAppliedConfig();
+        if (success) {
+            loadRegisterCache(false);
+        }
+    }
+    
     {
         epicsGuard<asynPortDriver> lock(*this);
         
@@ -743,8 +1913,13 @@ void TR_CAEN::handleWorkerTaskCalibrate ()
     assert(m_calibrating);
     assertOpenFromWorker();
     
+    {
+        epicsGuard<epicsMutex> lock(m_acq_control_mutex);
+        stopDigitizerIfRunning();
+    }
+    
     // Do the calibration.
-    CAEN_DGTZ_ErrorCode ret = CAEN_DGTZ_Calibrate(m_dev_handle);
+    CAEN_DGTZ_ErrorCode ret = m_backend->calibrate();
     
     bool success = ret == CAEN_DGTZ_Success;
     if (!success) {
@@ -772,12 +1947,123 @@ void TR_CAEN::handleWorkerTaskRefresh ()
     assert(m_refreshing);
     assertOpenFromWorker();
     
-    // TODO
-    bool success = true;
+    char const *function = "handleWorkerTaskRefresh";
+    
+    // Positions of the status registers in the batch, followed by the
+    // shadowed registers.
+    enum {
+        RefreshAcqStatus,
+        RefreshEventStored,
+        RefreshAcqControl,
+        RefreshTemperature,
+        NumRefreshStatusRegs = RefreshTemperature + MaxNumChannels
+    };
+    
+    TR_CAEN_Register const *regs[MaxRegisterBatch];
+    uint32_t values[MaxRegisterBatch];
+    bool ok[MaxRegisterBatch];
+    
+    regs[RefreshAcqStatus] = &Registers::AcqStatus;
+    regs[RefreshEventStored] = &Registers::EventStored;
+    regs[RefreshAcqControl] = &Registers::AcqControl;
+    for (int ch = 0; ch < MaxNumChannels; ch++) {
+        regs[RefreshTemperature+ch] = &Registers::ChannelTemperature[ch];
+    }
+    
+    std::vector<TR_CAEN_Register const *> const &cache_regs = m_reg_cache.getRegisters();
+    int num_regs = NumRefreshStatusRegs + cache_regs.size();
+    assert(num_regs <= MaxRegisterBatch);
+    std::copy(cache_regs.begin(), cache_regs.end(), regs + NumRefreshStatusRegs);
+    
+    // Read everything in one batch and check the register cache against
+    // the digitizer. The lock keeps writes from changing the shadowed
+    // registers while doing this.
+    bool success;
+    uint32_t trigger_mask = 0;
+    uint32_t fan_control = 0;
+    bool trigger_mask_ok;
+    bool fan_control_ok;
+    {
+        epicsGuard<epicsMutex> lock(m_reg_cache_mutex);
+        
+        success = readRegisters(function, regs, num_regs, values, ok);
+        
+        applyRegisterCacheValues(regs + NumRefreshStatusRegs, num_regs - NumRefreshStatusRegs,
+                                 values + NumRefreshStatusRegs, ok + NumRefreshStatusRegs, true);
+        
+        trigger_mask_ok = m_reg_cache.get(Registers::TriggerSourceEnableMask, &trigger_mask);
+        fan_control_ok = m_reg_cache.get(Registers::FanSpeedControl, &fan_control);
+    }
     
     {
         epicsGuard<asynPortDriver> lock(*this);
         
+        // Decode the readbacks, callbacks are only done for parameters
+        // which changed.
+        uint32_t acq_status = values[RefreshAcqStatus];
+        asynStatus acq_status_status = ok[RefreshAcqStatus] ? asynSuccess : asynError;
+        if (acq_status_status == asynSuccess) {
+            setIntegerParam(m_asyn_params[ACQ_RUNNING],    TR_CAEN_GetBit(acq_status, 2));
+            setIntegerParam(m_asyn_params[ACQ_EVENT_FULL], TR_CAEN_GetBit(acq_status, 4));
+            setIntegerParam(m_asyn_params[PLL_LOCKED],     TR_CAEN_GetBit(acq_status, 7));
+            setIntegerParam(m_asyn_params[BOARD_READY],    TR_CAEN_GetBit(acq_status, 8));
+        }
+        setParamStatus(m_asyn_params[ACQ_RUNNING],    acq_status_status);
+        setParamStatus(m_asyn_params[ACQ_EVENT_FULL], acq_status_status);
+        setParamStatus(m_asyn_params[PLL_LOCKED],     acq_status_status);
+        setParamStatus(m_asyn_params[BOARD_READY],    acq_status_status);
+        
+        if (ok[RefreshEventStored]) {
+            setIntegerParam(m_asyn_params[EVENTS_STORED], values[RefreshEventStored]);
+        }
+        setParamStatus(m_asyn_params[EVENTS_STORED], ok[RefreshEventStored] ? asynSuccess : asynError);
+        
+        for (int ch = 0; ch < MaxNumChannels; ch++) {
+            if (ok[RefreshTemperature+ch]) {
+                setIntegerParam(m_asyn_params[CH_TEMPERATURE_FIRST+ch], values[RefreshTemperature+ch] & 0xFF);
+            }
+            setParamStatus(m_asyn_params[CH_TEMPERATURE_FIRST+ch], ok[RefreshTemperature+ch] ? asynSuccess : asynError);
+        }
+        
+        if (ok[RefreshAcqControl]) {
+            setIntegerParam(m_asyn_params[CLOCK_SOURCE_RB],
+                TR_CAEN_GetBit(values[RefreshAcqControl], 6) ? ClockSourceExternal : ClockSourceInternal);
+        }
+        setParamStatus(m_asyn_params[CLOCK_SOURCE_RB], ok[RefreshAcqControl] ? asynSuccess : asynError);
+        
+        if (fan_control_ok) {
+            setIntegerParam(m_asyn_params[FAN_CONTROL_MODE_RB],
+                TR_CAEN_GetBit(fan_control, 3) ? FanControlModeFullSpeed : FanControlModeSlowAuto);
+        }
+        setParamStatus(m_asyn_params[FAN_CONTROL_MODE_RB], fan_control_ok ? asynSuccess : asynError);
+        
+        asynStatus trigger_mask_status = trigger_mask_ok ? asynSuccess : asynError;
+        if (trigger_mask_ok) {
+            setIntegerParam(m_asyn_params[SW_TRIGGER_RB],
+                TR_CAEN_GetBit(trigger_mask, 31) ? TriggerModeEnable : TriggerModeDisable);
+            setIntegerParam(m_asyn_params[EXT_TRIGGER_RB],
+                TR_CAEN_GetBit(trigger_mask, 30) ? TriggerModeEnable : TriggerModeDisable);
+            for (int i = 0; i < NumChannelPairs; i++) {
+                setIntegerParam(m_asyn_params[CH_SELF_TRIGGER_01_RB+i],
+                    TR_CAEN_GetBit(trigger_mask, i) ? TriggerModeEnable : TriggerModeDisable);
+            }
+        }
+        setParamStatus(m_asyn_params[SW_TRIGGER_RB], trigger_mask_status);
+        setParamStatus(m_asyn_params[EXT_TRIGGER_RB], trigger_mask_status);
+        for (int i = 0; i < NumChannelPairs; i++) {
+            setParamStatus(m_asyn_params[CH_SELF_TRIGGER_01_RB+i], trigger_mask_status);
+        }
+        
+        // Update the raw recording statistics.
+        int record_raw_state;
+        getIntegerParam(m_asyn_params[RECORD_RAW_STATE], &record_raw_state);
+        if (record_raw_state == RecordRawStateRecording) {
+            updateRawRecordingStatus(false);
+        }
+        
+        // Update the register access statistics.
+        updateRegisterStats();
+        
         // Set refreshing back to false.
         m_refreshing = false;
         
@@ -805,7 +2091,7 @@ void TR_CAEN::handleWorkerTaskSetFan ()
     modifyRegister(function, Registers::FanSpeedControl, 3, 1, fan_control_bit);
     
     // Update the readback.
-    readFanControlMode();
+    readFanControlMode(getVerifyReadbacks());
 }
 
 void TR_CAEN::handleWorkerTaskSetClockSource ()
@@ -829,7 +2115,7 @@ void TR_CAEN::handleWorkerTaskSetClockSource ()
     }
     
     // Update the readback.
-    readClockSource();
+    readClockSource(getVerifyReadbacks());
 }
 
 void TR_CAEN::handleWorkerTaskSetSwTrigger ()
@@ -850,7 +2136,7 @@ void TR_CAEN::handleWorkerTaskSetSwTrigger ()
     modifyRegister(function, Registers::TriggerSourceEnableMask, 31, 1, trigger_value);
     
     // Update the readback.
-    readSwTrigger();
+    readSwTrigger(getVerifyReadbacks());
 }
 
 void TR_CAEN::handleWorkerTaskSetExtTrigger ()
@@ -871,7 +2157,7 @@ void TR_CAEN::handleWorkerTaskSetExtTrigger ()
     modifyRegister(function, Registers::TriggerSourceEnableMask, 30, 1, trigger_value);
     
     // Update the readback.
-    readExtTrigger();
+    readExtTrigger(getVerifyReadbacks());
 }
 
 void TR_CAEN::handleWorkerTaskSetChSelfTrigger (int ch_pair)
@@ -893,25 +2179,15 @@ void TR_CAEN::handleWorkerTaskSetChSelfTrigger (int ch_pair)
     modifyRegister(function, Registers::TriggerSourceEnableMask, ch_pair, 1, trigger_value);
     
     // Update the readback.
-    readChSelfTrigger(ch_pair);
+    readChSelfTrigger(ch_pair, getVerifyReadbacks());
 }
 
 bool TR_CAEN::openDigitizer ()
 {
-    // Parse the address string.
-    int link_number;
-    int conet_node;
-    if (!TR_CAEN_ParseAddrStr(m_device_addr_str, &link_number, &conet_node)) {
-        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s openDigitizer: Bad device address string.\n",
-            portName);
-        return false;
-    }
-    
-    asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, "%s Opening digitizer (link_number=%d conet_node=%d).\n",
-        portName, link_number, conet_node);
+    asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, "%s Opening digitizer (%s).\n",
+        portName, m_backend->getDescription().c_str());
     
-    CAEN_DGTZ_ErrorCode ret = CAEN_DGTZ_OpenDigitizer(
-        CAEN_DGTZ_OpticalLink, link_number, conet_node, 0, &m_dev_handle);
+    CAEN_DGTZ_ErrorCode ret = m_backend->open();
     
     if (ret != CAEN_DGTZ_Success) {
         asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s openDigitizer: Failed with error %d: %s.\n",
@@ -922,6 +2198,14 @@ bool TR_CAEN::openDigitizer ()
     // Read the digitizer information.
     refreshDigitizerInfo();
     
+    // Load the register cache, values from before are not valid anymore.
+    {
+        epicsGuard<epicsMutex> lock(m_acq_control_mutex);
+        m_digitizer_running = false;
+        invalidateAppliedConfig();
+        loadRegisterCache(false);
+    }
+    
     return true;
 }
 
@@ -929,7 +2213,12 @@ bool TR_CAEN::closeDigitizer ()
 {
     asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, "%s Closing digitizer.\n", portName);
     
-    CAEN_DGTZ_ErrorCode ret = CAEN_DGTZ_CloseDigitizer(m_dev_handle);
+    {
+        epicsGuard<epicsMutex> lock(m_acq_control_mutex);
+        stopDigitizerIfRunning();
+    }
+    
+    CAEN_DGTZ_ErrorCode ret = m_backend->close();
     
     if (ret != CAEN_DGTZ_Success) {
         asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s closeDigitizer: Failed with error %d: %s.\n",
@@ -939,9 +2228,57 @@ bool TR_CAEN::closeDigitizer ()
         return false;
     }
     
+    // Free the readout buffers, they are allocated again when arming.
+    freeReadoutBuffers();
+    
+    return true;
+}
+
+bool TR_CAEN::allocateReadoutBuffers ()
+{
+    char const *function = "allocateReadoutBuffers";
+    CAEN_DGTZ_ErrorCode err;
+    
+    // Free any buffers from a previous arming, the size may have changed.
+    freeReadoutBuffers();
+    
+    for (size_t i = 0; i < NumReadoutBuffers; i++) {
+        ReadoutBuffer &rb = m_readout_ring.item(i);
+        
+        err = m_backend->mallocReadoutBuffer(&rb.buffer, &rb.buffer_size);
+        if (err != CAEN_DGTZ_Success) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s %s: MallocReadoutBuffer failed with error %d: %s.\n",
+                portName, function, (int)err, m_error_codes.getErrorText(err));
+            rb.buffer = NULL;
+            rb.buffer_size = 0;
+            freeReadoutBuffers();
+            return false;
+        }
+    }
+    
+    m_readout_buffers_allocated = true;
+    
     return true;
 }
 
+void TR_CAEN::freeReadoutBuffers ()
+{
+    for (size_t i = 0; i < NumReadoutBuffers; i++) {
+        ReadoutBuffer &rb = m_readout_ring.item(i);
+        
+        if (rb.buffer != NULL) {
+            m_backend->freeReadoutBuffer(&rb.buffer);
+            rb.buffer = NULL;
+            rb.buffer_size = 0;
+        }
+        rb.data_words = 0;
+    }
+    
+    m_readout_buffers_allocated = false;
+    m_readout_ring.reset();
+    m_readout_current = NULL;
+}
+
 bool TR_CAEN::refreshDigitizerInfo ()
 {
     char const *function = "refreshDigitizerInfo";
@@ -949,7 +2286,7 @@ bool TR_CAEN::refreshDigitizerInfo ()
     
     // Call the GetInfo function to get what the driver gives us directly.
     CAEN_DGTZ_BoardInfo_t info;
-    err = CAEN_DGTZ_GetInfo(m_dev_handle, &info);
+    err = m_backend->getInfo(&info);
     if (err != CAEN_DGTZ_Success) {
         asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s %s: GetInfo failed with error %d: %s.\n",
             portName, function, (int)err, m_error_codes.getErrorText(err));
@@ -996,7 +2333,7 @@ void TR_CAEN::clearDigitizerInfo ()
     setIntegerParam(m_asyn_params[INFO_CH_MEM_SIZE], 0);
 }
 
-void TR_CAEN::readFanControlMode ()
+void TR_CAEN::readFanControlMode (bool verify)
 {
     char const *function = "readFanControlMode";
     
@@ -1004,7 +2341,7 @@ void TR_CAEN::readFanControlMode ()
     FanControlMode value;
     
     uint32_t fan_speed_control;
-    if (readRegister(function, Registers::FanSpeedControl, &fan_speed_control)) {
+    if (readRegisterCached(function, Registers::FanSpeedControl, &fan_speed_control, verify)) {
         status = asynSuccess;
         value = TR_CAEN_GetBit(fan_speed_control, 3) ? FanControlModeFullSpeed : FanControlModeSlowAuto;
     }
@@ -1020,7 +2357,7 @@ void TR_CAEN::readFanControlMode ()
     }
 }
 
-void TR_CAEN::readClockSource ()
+void TR_CAEN::readClockSource (bool verify)
 {
     char const *function = "readClockSource";
     
@@ -1028,7 +2365,7 @@ void TR_CAEN::readClockSource ()
     ClockSource value;
     
     uint32_t acq_control;
-    if (readRegister(function, Registers::AcqControl, &acq_control)) {
+    if (readRegisterCached(function, Registers::AcqControl, &acq_control, verify)) {
         status = asynSuccess;
         value = TR_CAEN_GetBit(acq_control, 6) ? ClockSourceExternal : ClockSourceInternal;
     }
@@ -1044,7 +2381,7 @@ void TR_CAEN::readClockSource ()
     }
 }
 
-void TR_CAEN::readSwTrigger ()
+void TR_CAEN::readSwTrigger (bool verify)
 {
     char const *function = "readSwTrigger";
     
@@ -1052,7 +2389,7 @@ void TR_CAEN::readSwTrigger ()
     TriggerMode value;
     
     uint32_t trigger_src_en_mask;
-    if (readRegister(function, Registers::TriggerSourceEnableMask, &trigger_src_en_mask)) {
+    if (readRegisterCached(function, Registers::TriggerSourceEnableMask, &trigger_src_en_mask, verify)) {
         status = asynSuccess;
         value = TR_CAEN_GetBit(trigger_src_en_mask, 31) ? TriggerModeEnable : TriggerModeDisable;
     }
@@ -1068,7 +2405,7 @@ void TR_CAEN::readSwTrigger ()
     }
 }
 
-void TR_CAEN::readExtTrigger ()
+void TR_CAEN::readExtTrigger (bool verify)
 {
     char const *function = "readExtTrigger";
     
@@ -1076,7 +2413,7 @@ void TR_CAEN::readExtTrigger ()
     TriggerMode value;
     
     uint32_t trigger_src_en_mask;
-    if (readRegister(function, Registers::TriggerSourceEnableMask, &trigger_src_en_mask)) {
+    if (readRegisterCached(function, Registers::TriggerSourceEnableMask, &trigger_src_en_mask, verify)) {
         status = asynSuccess;
         value = TR_CAEN_GetBit(trigger_src_en_mask, 30) ? TriggerModeEnable : TriggerModeDisable;
     }
@@ -1092,7 +2429,7 @@ void TR_CAEN::readExtTrigger ()
     }
 }
 
-void TR_CAEN::readChSelfTrigger (int ch_pair)
+void TR_CAEN::readChSelfTrigger (int ch_pair, bool verify)
 {
     assert(ch_pair >= 0 && ch_pair < NumChannelPairs);
     
@@ -1102,7 +2439,7 @@ void TR_CAEN::readChSelfTrigger (int ch_pair)
     TriggerMode value;
     
     uint32_t trigger_src_en_mask;
-    if (readRegister(function, Registers::TriggerSourceEnableMask, &trigger_src_en_mask)) {
+    if (readRegisterCached(function, Registers::TriggerSourceEnableMask, &trigger_src_en_mask, verify)) {
         status = asynSuccess;
         value = TR_CAEN_GetBit(trigger_src_en_mask, ch_pair) ? TriggerModeEnable : TriggerModeDisable;
     }
@@ -1120,7 +2457,9 @@ void TR_CAEN::readChSelfTrigger (int ch_pair)
 
 bool TR_CAEN::readRegister (char const *function, TR_CAEN_Register const &reg, uint32_t *out_value)
 {
-    CAEN_DGTZ_ErrorCode err = CAEN_DGTZ_ReadRegister(m_dev_handle, reg.reg_addr, out_value);
+    uint64_t start_time = TR_CAEN_RegisterStats::now();
+    CAEN_DGTZ_ErrorCode err = m_backend->readRegister(reg.reg_addr, out_value);
+    m_reg_stats.record(reg.reg_name, reg.reg_addr, false, TR_CAEN_RegisterStats::now() - start_time, err);
     
     if (err != CAEN_DGTZ_Success) {
         asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s %s: ReadRegister(%s) failed with error %d: %s.\n",
@@ -1131,23 +2470,129 @@ bool TR_CAEN::readRegister (char const *function, TR_CAEN_Register const &reg, u
     return true;
 }
 
+bool TR_CAEN::readRegisterCached (char const *function, TR_CAEN_Register const &reg, uint32_t *out_value, bool verify)
+{
+    epicsGuard<epicsMutex> lock(m_reg_cache_mutex);
+    
+    if (!verify && m_reg_cache.get(reg, out_value)) {
+        return true;
+    }
+    
+    if (!readRegister(function, reg, out_value)) {
+        return false;
+    }
+    
+    m_reg_cache.set(reg, *out_value);
+    
+    return true;
+}
+
 bool TR_CAEN::writeRegister (char const *function, TR_CAEN_Register const &reg, uint32_t value)
 {
-    CAEN_DGTZ_ErrorCode err = CAEN_DGTZ_WriteRegister(m_dev_handle, reg.reg_addr, value);
+    epicsGuard<epicsMutex> lock(m_reg_cache_mutex);
+    
+    uint64_t start_time = TR_CAEN_RegisterStats::now();
+    CAEN_DGTZ_ErrorCode err = m_backend->writeRegister(reg.reg_addr, value);
+    m_reg_stats.record(reg.reg_name, reg.reg_addr, true, TR_CAEN_RegisterStats::now() - start_time, err);
     
     if (err != CAEN_DGTZ_Success) {
         asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s %s: WriteRegister(%s) failed with error %d: %s.\n",
             portName, function, reg.reg_name, (int)err, m_error_codes.getErrorText(err));
+        // The register may or may not have been written.
+        m_reg_cache.invalidate(reg);
         return false;
     }
     
+    m_reg_cache.set(reg, value);
+    
     return true;
 }
 
+bool TR_CAEN::readRegisters (char const *function, TR_CAEN_Register const *const regs[], int num_regs,
+                             uint32_t out_values[], bool out_ok[])
+{
+    assert(num_regs <= MaxRegisterBatch);
+    
+    if (num_regs == 0) {
+        return true;
+    }
+    
+    TR_CAEN_RegisterCycle cycles[MaxRegisterBatch];
+    for (int i = 0; i < num_regs; i++) {
+        cycles[i].address = regs[i]->reg_addr;
+        cycles[i].value = 0;
+        cycles[i].err = CAEN_DGTZ_Success;
+    }
+    
+    uint64_t start_time = TR_CAEN_RegisterStats::now();
+    CAEN_DGTZ_ErrorCode first_err = m_backend->multiReadRegisters(cycles, num_regs);
+    m_reg_stats.recordBatch(TR_CAEN_RegisterStats::now() - start_time);
+    
+    for (int i = 0; i < num_regs; i++) {
+        TR_CAEN_Register const &reg = *regs[i];
+        CAEN_DGTZ_ErrorCode err = cycles[i].err;
+        
+        m_reg_stats.recordBatched(reg.reg_name, reg.reg_addr, false, err);
+        
+        if (err != CAEN_DGTZ_Success) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s %s: ReadRegister(%s) failed with error %d: %s.\n",
+                portName, function, reg.reg_name, (int)err, m_error_codes.getErrorText(err));
+        }
+        
+        out_values[i] = cycles[i].value;
+        out_ok[i] = err == CAEN_DGTZ_Success;
+    }
+    
+    return first_err == CAEN_DGTZ_Success;
+}
+
+bool TR_CAEN::writeRegisters (char const *function, TR_CAEN_Register const *const regs[], int num_regs,
+                              uint32_t const values[])
+{
+    assert(num_regs <= MaxRegisterBatch);
+    
+    if (num_regs == 0) {
+        return true;
+    }
+    
+    epicsGuard<epicsMutex> lock(m_reg_cache_mutex);
+    
+    TR_CAEN_RegisterCycle cycles[MaxRegisterBatch];
+    for (int i = 0; i < num_regs; i++) {
+        cycles[i].address = regs[i]->reg_addr;
+        cycles[i].value = values[i];
+        cycles[i].err = CAEN_DGTZ_Success;
+    }
+    
+    uint64_t start_time = TR_CAEN_RegisterStats::now();
+    CAEN_DGTZ_ErrorCode first_err = m_backend->multiWriteRegisters(cycles, num_regs);
+    m_reg_stats.recordBatch(TR_CAEN_RegisterStats::now() - start_time);
+    
+    for (int i = 0; i < num_regs; i++) {
+        TR_CAEN_Register const &reg = *regs[i];
+        CAEN_DGTZ_ErrorCode err = cycles[i].err;
+        
+        m_reg_stats.recordBatched(reg.reg_name, reg.reg_addr, true, err);
+        
+        if (err != CAEN_DGTZ_Success) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s %s: WriteRegister(%s) failed with error %d: %s.\n",
+                portName, function, reg.reg_name, (int)err, m_error_codes.getErrorText(err));
+            m_reg_cache.invalidate(reg);
+        } else {
+            m_reg_cache.set(reg, values[i]);
+        }
+    }
+    
+    return first_err == CAEN_DGTZ_Success;
+}
+
 bool TR_CAEN::modifyRegister (char const *function, TR_CAEN_Register const &reg, int bit_offset, int num_bits, uint32_t value)
 {
+    // Shadowed registers are only written, others are read first.
+    epicsGuard<epicsMutex> lock(m_reg_cache_mutex);
+    
     uint32_t reg_value;
-    if (!readRegister(function, reg, &reg_value)) {
+    if (!readRegisterCached(function, reg, &reg_value, false)) {
         return false;
     }
     
@@ -1156,6 +2601,192 @@ bool TR_CAEN::modifyRegister (char const *function, TR_CAEN_Register const &reg,
     return writeRegister(function, reg, reg_value);
 }
 
+bool TR_CAEN::writeRegistersIfChanged (char const *function, TR_CAEN_Register const *const regs[], int num_regs,
+                                       uint32_t const values[])
+{
+    // Used when arming, with m_acq_control_mutex locked.
+    assert(num_regs <= MaxRegisterBatch);
+    
+    epicsGuard<epicsMutex> lock(m_reg_cache_mutex);
+    
+    // Leave out registers known to have the value already.
+    TR_CAEN_Register const *changed_regs[MaxRegisterBatch];
+    uint32_t changed_values[MaxRegisterBatch];
+    int num_changed = 0;
+    
+    for (int i = 0; i < num_regs; i++) {
+        uint32_t cached_value;
+        if (m_reg_cache.get(*regs[i], &cached_value) && cached_value == values[i]) {
+            continue;
+        }
+        changed_regs[num_changed] = regs[i];
+        changed_values[num_changed] = values[i];
+        num_changed++;
+    }
+    
+    if (num_changed > 0) {
+        stopDigitizerIfRunning();
+    }
+    
+    return writeRegisters(function, changed_regs, num_changed, changed_values);
+}
+
+bool TR_CAEN::writeChannelRegisters (char const *function, TR_CAEN_Register const channel_regs[],
+                                     TR_CAEN_Register const &broadcast_reg, uint32_t const values[], uint32_t ch_mask)
+{
+    // Used when arming, with m_acq_control_mutex locked.
+    epicsGuard<epicsMutex> lock(m_reg_cache_mutex);
+    
+    // Find the channels whose register needs to be written (according to
+    // the cache) and whether all channels in the mask share the value.
+    int num_to_write = 0;
+    bool same_value = true;
+    int first_ch = -1;
+    
+    for (int ch = 0; ch < MaxNumChannels; ch++) {
+        if (!TR_CAEN_GetBit(ch_mask, ch)) {
+            continue;
+        }
+        
+        if (first_ch < 0) {
+            first_ch = ch;
+        }
+        else if (values[ch] != values[first_ch]) {
+            same_value = false;
+        }
+        
+        uint32_t cached_value;
+        if (!m_reg_cache.get(channel_regs[ch], &cached_value) || cached_value != values[ch]) {
+            num_to_write++;
+        }
+    }
+    
+    if (num_to_write == 0) {
+        return true;
+    }
+    
+    stopDigitizerIfRunning();
+    
+    // With more than one write needed and a common value, write all
+    // channels with the broadcast address (also channels not in the mask,
+    // which is harmless since they are disabled).
+    if (num_to_write > 1 && same_value) {
+        if (!writeRegister(function, broadcast_reg, values[first_ch])) {
+            for (int ch = 0; ch < MaxNumChannels; ch++) {
+                m_reg_cache.invalidate(channel_regs[ch]);
+            }
+            return false;
+        }
+        
+        for (int ch = 0; ch < MaxNumChannels; ch++) {
+            m_reg_cache.set(channel_regs[ch], values[first_ch]);
+        }
+        
+        return true;
+    }
+    
+    // Otherwise write only the channels which changed, in one batch.
+    TR_CAEN_Register const *batch_regs[MaxNumChannels];
+    uint32_t batch_values[MaxNumChannels];
+    int num_batch = 0;
+    
+    for (int ch = 0; ch < MaxNumChannels; ch++) {
+        if (!TR_CAEN_GetBit(ch_mask, ch)) {
+            continue;
+        }
+        
+        uint32_t cached_value;
+        if (m_reg_cache.get(channel_regs[ch], &cached_value) && cached_value == values[ch]) {
+            continue;
+        }
+        
+        batch_regs[num_batch] = &channel_regs[ch];
+        batch_values[num_batch] = values[ch];
+        num_batch++;
+    }
+    
+    return writeRegisters(function, batch_regs, num_batch, batch_values);
+}
+
+void TR_CAEN::invalidateAppliedConfig ()
+{
+    // Must be called with m_acq_control_mutex locked.
+    
+    m_applied_acq_mode.invalidate();
+    m_applied_record_length.invalidate();
+    m_applied_zs_mode.invalidate();
+    for (int ch = 0; ch < MaxNumChannels; ch++) {
+        m_applied_zs_params[ch].invalidate();
+        m_applied_zle_negative[ch].invalidate();
+    }
+    m_applied_events_per_blt.invalidate();
+    m_applied_irq_config.invalidate();
+    
+    // Register settings are skipped based on the register cache.
+    epicsGuard<epicsMutex> lock(m_reg_cache_mutex);
+    m_reg_cache.invalidateAll();
+}
+
+bool TR_CAEN::loadRegisterCache (bool check)
+{
+    char const *function = "loadRegisterCache";
+    
+    epicsGuard<epicsMutex> lock(m_reg_cache_mutex);
+    
+    // Read all shadowed registers in one batch.
+    std::vector<TR_CAEN_Register const *> const &registers = m_reg_cache.getRegisters();
+    int num_regs = registers.size();
+    
+    uint32_t values[MaxRegisterBatch];
+    bool ok[MaxRegisterBatch];
+    bool success = readRegisters(function, &registers[0], num_regs, values, ok);
+    
+    applyRegisterCacheValues(&registers[0], num_regs, values, ok, check);
+    
+    return success;
+}
+
+void TR_CAEN::applyRegisterCacheValues (TR_CAEN_Register const *const regs[], int num_regs,
+                                        uint32_t const values[], bool const ok[], bool check)
+{
+    // Must be called with m_reg_cache_mutex locked.
+    
+    char const *function = "applyRegisterCacheValues";
+    
+    for (int i = 0; i < num_regs; i++) {
+        TR_CAEN_Register const &reg = *regs[i];
+        
+        if (!ok[i]) {
+            m_reg_cache.invalidate(reg);
+            continue;
+        }
+        
+        // Report registers changed behind our back (e.g. by another program).
+        uint32_t cached_value;
+        if (check && m_reg_cache.get(reg, &cached_value) && cached_value != values[i]) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s %s: %s is 0x%08x, expected 0x%08x.\n",
+                portName, function, reg.reg_name, (unsigned int)values[i], (unsigned int)cached_value);
+        }
+        
+        m_reg_cache.set(reg, values[i]);
+    }
+}
+
+bool TR_CAEN::getVerifyReadbacks ()
+{
+    epicsGuard<asynPortDriver> lock(*this);
+    
+    int verify;
+    getIntegerParam(m_asyn_params[REG_VERIFY_READBACKS], &verify);
+    
+    return verify != 0;
+}
+
+bool TR_CAEN::isChannelEnabledSnapshot (int ch)
+{
+    return m_param_channel[ch].enable.getSnapshot() == 1;
+}
+
 void TR_CAEN::setIntegerParamSuccess (int param, int value)
 {
     setIntegerParam(param, value);
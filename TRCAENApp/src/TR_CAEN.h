@@ -12,27 +12,46 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <epicsEvent.h>
 #include <epicsMutex.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
 
 #include <TRBaseDriver.h>
 #include <TRWorkerThread.h>
 
+#include "TR_CAEN_AppliedValue.h"
+#include "TR_CAEN_Backend.h"
+#include "TR_CAEN_Decoder.h"
 #include "TR_CAEN_ErrorCodes.h"
+#include "TR_CAEN_LinkScheduler.h"
+#include "TR_CAEN_RawRecorder.h"
+#include "TR_CAEN_RegisterCache.h"
+#include "TR_CAEN_RegisterStats.h"
 #include "TR_CAEN_Registers.h"
+#include "TR_CAEN_SampleUnpack.h"
+#include "TR_CAEN_SpscRing.h"
 
 class TR_CAEN;
+class TRChannelDataSubmit;
 
-class TR_CAEN : public TRBaseDriver, private TRWorkerThreadRunnable
+class TR_CAEN : public TRBaseDriver, private TRWorkerThreadRunnable, private TR_CAEN_LinkClient
 {
 public:
     TR_CAEN (
-        char const *port_name, char const *device_addr_str,
+        char const *port_name, char const *device_addr_str, TR_CAEN_Backend *backend,
+        TR_CAEN_LinkScheduler *link_scheduler, TRWorkerThread *shared_worker,
         int read_thread_prio_epics, int read_thread_stack_size,
         int max_ad_buffers, size_t max_ad_memory);
+    
+    // Prints the register access statistics and optionally clears them.
+    void registerReport (FILE *out, bool reset);
 
 private:
     // Typedef for less typing.
@@ -44,6 +63,45 @@ private:
     // Number of channel pairs.
     static int const NumChannelPairs = 4;
     
+    // The record length must be a multiple of this many samples.
+    static int const RecordLengthGranularity = 4;
+    
+    // Number of samples per unit of the Post Trigger register.
+    static int const PostTriggerUnitSamples = 2;
+    
+    // Number of samples per unit of the ZLE look-back/look-ahead windows,
+    // and the maximum window in these units.
+    static int const ZleWindowUnitSamples = 2;
+    static int const MaxZleWindowUnits = 0xFFFF;
+    
+    // Maximum ZLE threshold (ADC counts).
+    static int const MaxZleThreshold = 16383;
+    
+    // Maximum decimation exponent (decimation factor 2^N).
+    static int const MaxDecimationExponent = 7;
+    
+    // Maximum number of events per block transfer supported by the digitizer.
+    static int const MaxEventsPerBlt = 1023;
+    
+    // Number of readout buffers between the link reader and the decoder.
+    static size_t const NumReadoutBuffers = 4;
+    
+    // Timeout of the link scheduler waiting for an interrupt (milliseconds).
+    // This bounds how long it takes for the link reader to notice a stop request.
+    static uint32_t const IrqWaitTimeoutMs = 10;
+    
+    // Minimum time between link reader checks of the acquisition status (seconds).
+    static double const StatusCheckInterval;
+    
+    // Maximum number of registers in a batch access.
+    static int const MaxRegisterBatch = 64;
+    
+    // Maximum VME interrupt level (0 disables interrupts).
+    static int const MaxIrqLevel = 7;
+    
+    // Status/ID reported with the interrupts.
+    static uint32_t const IrqStatusId = 0xCAE0;
+    
     // Enumeration of regular parameters
     enum CAENAsynParams {
         FIRST_PARAM,
@@ -97,6 +155,40 @@ private:
         CH_SELF_TRIGGER_45_RB,
         CH_SELF_TRIGGER_67_RB,
         
+        // Status readbacks updated on each refresh: acquisition running,
+        // event memory full, PLL locked, board ready, number of events
+        // stored, and the ADC temperature of each channel (degrees C).
+        ACQ_RUNNING,
+        ACQ_EVENT_FULL,
+        PLL_LOCKED,
+        BOARD_READY,
+        EVENTS_STORED,
+        CH_TEMPERATURE_FIRST,
+        CH_TEMPERATURE_LAST = CH_TEMPERATURE_FIRST + MaxNumChannels - 1,
+        
+        // Raw recording: enable, file path prefix, and status readbacks.
+        RECORD_RAW,
+        RECORD_RAW_PATH,
+        RECORD_RAW_BUFFERS,
+        RECORD_RAW_STATE,
+        RECORD_RAW_FILE,
+        RECORD_RAW_MBYTES,
+        RECORD_RAW_DROPPED,
+        
+        // Register access statistics since the previous refresh: accesses
+        // per second, 99th percentile latency (us) and errors per second.
+        REG_OPS_RATE,
+        REG_LATENCY_P99,
+        REG_ERROR_RATE,
+        
+        // If set, readbacks after changing a setting are read from the
+        // digitizer instead of the register cache.
+        REG_VERIFY_READBACKS,
+        
+        // If set, arming applies all settings even if they are the same as
+        // applied at the previous arm.
+        FORCE_FULL_ARM,
+        
         NUM_CAEN_ASYN_PARAMS
     };
     
@@ -132,28 +224,53 @@ private:
     // Enumeration of input ranges.
     enum InputRange {InputRange2V, InputRange05V};
     
+    // Enumeration of sample formats of the channel arrays.
+    enum SampleFormat {SampleFormatRaw, SampleFormatVolts};
+    
+    // Enumeration of ZLE (zero length encoding) modes. In sparse mode, each
+    // stored segment is published as a separate array, otherwise the skipped
+    // samples are filled with zeros.
+    enum ZleMode {ZleModeOff, ZleModeSparse, ZleModeZeroFilled};
+    
+    // Enumeration of ZLE threshold polarities.
+    enum ZlePolarity {ZlePolarityPositive, ZlePolarityNegative};
+    
+    // Enumeration of raw recording states.
+    enum RecordRawState {RecordRawStateOff, RecordRawStateRecording, RecordRawStateError};
+    
     // Enumeration of trigger enable/disable.
     enum TriggerMode {TriggerModeEnable, TriggerModeDisable};
     
     // List of regular parameters' asyn indices
     int m_asyn_params[NUM_CAEN_ASYN_PARAMS];
-
+    
     // Concrete configuration parameters
     // NOTE: update NumCAENConfigParams on any change!
     TRConfigParam<int>         m_param_start_stop_mode;
+    TRConfigParam<int>         m_param_events_per_blt;
     TRConfigParam<double>      m_param_run_start_stop_delay;
+    TRConfigParam<int>         m_param_sample_format;
+    TRConfigParam<int>         m_param_irq_level;
+    TRConfigParam<int>         m_param_irq_event_number;
+    TRConfigParam<int>         m_param_zle_mode;
+    TRConfigParam<int>         m_param_zle_polarity;
+    TRConfigParam<int>         m_param_continuous;
     struct {
+        TRConfigParam<int>         enable;
         TRConfigParam<int>         input_range;
         TRConfigParam<int, double> pulse_width;
+        TRConfigParam<int>         zle_threshold;
+        TRConfigParam<int>         zle_look_back;
+        TRConfigParam<int>         zle_look_ahead;
     } m_param_channel[MaxNumChannels];
     
-    static int const NumCAENConfigParams = 2 + (MaxNumChannels * 2);
-
+    static int const NumCAENConfigParams = 9 + (MaxNumChannels * 6);
+    
     // Map of CAEN error codes to descriptions.
     TR_CAEN_ErrorCodes m_error_codes;
     
-    // Worker thread.
-    TRWorkerThread m_worker;
+    // Worker thread, our own or shared with other digitizers on the link (pool mode).
+    TRWorkerThread *m_worker;
     
     // Worker thread tasks.
     TRWorkerThreadTask m_worker_task[NumWorkerTasks];
@@ -179,13 +296,161 @@ private:
     // Mutex used to prevent concurrent modification of the AcqControl register.
     epicsMutex m_acq_control_mutex;
     
-    // Device handle (if any depending on OpenState).
-    int m_dev_handle;
+    // Shadow copy of registers only changed by the driver, and the mutex
+    // protecting it. Writes of shadowed registers are done with the mutex
+    // locked so the cache is consistent with the digitizer.
+    TR_CAEN_RegisterCache m_reg_cache;
+    epicsMutex m_reg_cache_mutex;
+    
+    // Settings applied through library calls at the previous arm, so they
+    // are not applied again if unchanged (register settings are skipped
+    // based on the register cache). Protected by m_acq_control_mutex.
+    TR_CAEN_AppliedValue<int> m_applied_acq_mode;
+    TR_CAEN_AppliedValue<int> m_applied_record_length;
+    TR_CAEN_AppliedValue<int> m_applied_zs_mode;
+    TR_CAEN_AppliedValue<std::pair<int, int> > m_applied_zs_params[MaxNumChannels];
+    TR_CAEN_AppliedValue<bool> m_applied_zle_negative[MaxNumChannels];
+    TR_CAEN_AppliedValue<int> m_applied_events_per_blt;
+    TR_CAEN_AppliedValue<std::pair<int, int> > m_applied_irq_config;
+    
+    // Backend through which the digitizer is accessed (hardware or simulated).
+    TR_CAEN_Backend *m_backend;
+    
+    // A readout buffer allocated by the backend, filled by one ReadData.
+    struct ReadoutBuffer {
+        char *buffer;
+        uint32_t buffer_size;
+        size_t data_words;
+    };
+    
+    // Ring of readout buffers passed from the link reader thread to the
+    // decoder (the TRBaseDriver read thread). The buffers are (re)allocated
+    // when arming and freed when closing the device.
+    TR_CAEN_SpscRing<ReadoutBuffer, NumReadoutBuffers> m_readout_ring;
+    
+    // Whether the readout buffers are allocated.
+    bool m_readout_buffers_allocated;
+    
+    // The readout buffer being decoded (NULL if none).
+    ReadoutBuffer *m_readout_current;
+    
+    // Offset (in words) of the event in the current buffer being processed.
+    size_t m_readout_event_offset;
+    
+    // Offset (in words) of the next event in the current buffer.
+    size_t m_readout_next_offset;
+    
+    // Set by interruptReading to make readBurst return (protected by the port lock).
+    bool m_interrupt_reading;
+    
+    // Event signaled to wake up readBurst (new data, reader error or interrupt).
+    epicsEvent m_read_wakeup;
+    
+    // Scheduler of the link the digitizer is connected to, which issues
+    // ReadData into the readout ring (see linkReadoutStep).
+    TR_CAEN_LinkScheduler *m_link_scheduler;
+    
+    // Whether the link reader has been started (accessed by the read thread only).
+    bool m_link_reader_running;
+    
+    // Whether the link reader waits for data using interrupts (set when arming).
+    bool m_link_reader_use_irq;
+    
+    // Maximum number of events per transfer (set when arming).
+    int m_link_events_per_blt;
+    
+    // Estimated number of events in the digitizer which were not transferred
+    // yet (accessed by the link scheduler only).
+    int m_link_pending_events;
+    
+    // Link reader control and status flags (accessed atomically).
+    int m_link_reader_stop;
+    int m_link_reader_error;
+    
+    // Set by the link reader when it sees the digitizer memory full,
+    // cleared by checkOverflow (accessed atomically).
+    int m_link_memory_full;
+    
+    // Number of events stored in the digitizer at the last status check
+    // (accessed atomically).
+    int m_link_events_stored;
+    
+    // When the link reader last checked the acquisition status.
+    epicsTimeStamp m_link_status_check_time;
+    
+    // Event signaled by the link scheduler when the link reader has stopped.
+    epicsEvent m_link_reader_stopped;
+    
+    // ID of the next burst (event), reported with the channel arrays. In
+    // continuous mode it keeps counting as long as the digitizer runs.
+    uint64_t m_burst_id;
+    
+    // Extends the trigger time tags of the events, reset when the digitizer
+    // acquisition is started.
+    TR_CAEN_TimeTagExtender m_time_tag_extender;
+    
+    // Time when the digitizer acquisition was started (seconds since the
+    // EPICS epoch), for the absolute trigger times of the events.
+    double m_acq_start_time;
+    
+    // Whether the extended time tag of the current event is ambiguous,
+    // reported with the channel arrays.
+    bool m_time_tag_ambiguous;
+    
+    // Whether the acquisition is continuous, set when arming. Then the
+    // digitizer is not restarted after its memory was full and is left
+    // running when disarming.
+    bool m_continuous;
+    
+    // Whether the digitizer acquisition is started, possibly left running
+    // after disarming (protected by m_acq_control_mutex).
+    bool m_digitizer_running;
+    
+    // Sample unpack kernel (the fastest one supported by the CPU).
+    TR_CAEN_UnpackKernel const *m_unpack_kernel;
+    
+    // Record length and number of post-trigger samples, set when arming.
+    int m_record_length;
+    int m_num_post_samples;
+    
+    // Decimation exponent (decimation factor 2^N), set when arming.
+    int m_decimation_exponent;
+    
+    // ZLE mode, set when arming.
+    int m_zle_mode;
+    
+    // Segments of the ZLE channel being processed (reused to avoid allocation).
+    std::vector<TR_CAEN_ZleSegment> m_zle_segments;
+    
+    // Mask of enabled channels, set when arming.
+    uint32_t m_channel_enable_mask;
+    
+    // Recorder of the raw readout data.
+    TR_CAEN_RawRecorder m_raw_recorder;
+    
+    // Whether the link reader passes the readout data to the recorder
+    // (accessed atomically).
+    int m_raw_recording;
+    
+    // Sequence number for the next raw recording file name.
+    unsigned int m_raw_record_seq;
+    
+    // Register access statistics, and the totals and time at the previous
+    // update of the statistics parameters.
+    TR_CAEN_RegisterStats m_reg_stats;
+    TR_CAEN_RegisterStats::Snapshot m_reg_stats_prev;
+    uint64_t m_reg_stats_prev_time;
+    
+    // Conversion from samples to volts for each channel, set when arming.
+    struct {
+        float scale;
+        float offset;
+    } m_volts_conversion[MaxNumChannels];
 
 private:
     asynStatus writeInt32 (asynUser *pasynUser, int value); // override
     asynStatus readInt32 (asynUser *pasynUser, int32_t *value); // override
-
+    
     asynStatus handleOpenStateRequest (int32_t request);
     asynStatus handleResetRequest ();
     asynStatus handleCalibrateRequest ();
@@ -198,26 +463,56 @@ private:
     
     void setOpenState (OpenState open_state);
     
+    bool startRawRecording ();
+    void stopRawRecording ();
+    std::string rawRecordingHeader ();
+    void updateRawRecordingStatus (bool stopped);
+    
+    void updateRegisterStats ();
+    
     void requestedSampleRateChanged (); // override
     
+    static int decimationExponentForRate (double hw_sample_rate, double sample_rate);
+    
     bool waitForPreconditions (); // override
     
     bool checkSettings (TRArmInfo &arm_info); // override
-
+    
     bool startAcquisition (bool had_overflow); // override
-
-    //bool readBurst (); // override
-
-    //bool checkOverflow (bool *had_overflow, int *num_buffer_bursts); // override
-
-    //bool processBurstData (); // override
     
-    //void interruptReading (); // override
+    bool readBurst (); // override
+    
+    bool checkOverflow (bool *had_overflow, int *num_buffer_bursts); // override
+    
+    bool processBurstData (); // override
+    
+    void submitZleChannel (int ch, bool volts, size_t record_samples, TR_CAEN_EventHeader const &header,
+                           uint64_t time_tag, double timestamp);
+    
+    void submitChannelArray (TRChannelDataSubmit &data_submit, int ch, TR_CAEN_EventHeader const &header,
+                             uint64_t time_tag, double timestamp);
+    
+    void interruptReading (); // override
     
     void stopAcquisition (); // override
     
+    void disableInterrupt ();
+    void stopDigitizer ();
+    void stopDigitizerIfRunning ();
+    
     void runWorkerThreadTask (int id); // override
     
+    StepResult linkReadoutStep (); // override
+    int linkPendingEvents (); // override
+    bool linkUsesIrq (); // override
+    void linkWaitForIrq (); // override
+    void linkReadoutStopped (); // override
+    
+    void stopLinkReaderOnError ();
+    bool checkLinkStatus ();
+    void startLinkReader ();
+    void stopLinkReader ();
+    
     void assertOpenFromWorker ();
     
     void handleWorkerTaskOpenClose ();
@@ -233,18 +528,38 @@ private:
     bool openDigitizer ();
     bool closeDigitizer ();
     
+    bool allocateReadoutBuffers ();
+    void freeReadoutBuffers ();
+    
     bool refreshDigitizerInfo ();
     void clearDigitizerInfo ();
     
-    void readFanControlMode ();
-    void readClockSource ();
-    void readSwTrigger ();
-    void readExtTrigger ();
-    void readChSelfTrigger (int ch_pair);
+    void readFanControlMode (bool verify);
+    void readClockSource (bool verify);
+    void readSwTrigger (bool verify);
+    void readExtTrigger (bool verify);
+    void readChSelfTrigger (int ch_pair, bool verify);
+    bool getVerifyReadbacks ();
+    
+    bool loadRegisterCache (bool check);
+    void invalidateAppliedConfig ();
+    void applyRegisterCacheValues (TR_CAEN_Register const *const regs[], int num_regs,
+                                   uint32_t const values[], bool const ok[], bool check);
     
     bool readRegister (char const *function, TR_CAEN_Register const &reg, uint32_t *out_value);
+    bool readRegisterCached (char const *function, TR_CAEN_Register const &reg, uint32_t *out_value, bool verify);
     bool writeRegister (char const *function, TR_CAEN_Register const &reg, uint32_t value);
+    bool readRegisters (char const *function, TR_CAEN_Register const *const regs[], int num_regs,
+                        uint32_t out_values[], bool out_ok[]);
+    bool writeRegisters (char const *function, TR_CAEN_Register const *const regs[], int num_regs,
+                         uint32_t const values[]);
     bool modifyRegister (char const *function, TR_CAEN_Register const &reg, int bit_offset, int num_bits, uint32_t value);
+    bool writeRegistersIfChanged (char const *function, TR_CAEN_Register const *const regs[], int num_regs,
+                                  uint32_t const values[]);
+    bool writeChannelRegisters (char const *function, TR_CAEN_Register const channel_regs[],
+                                TR_CAEN_Register const &broadcast_reg, uint32_t const values[], uint32_t ch_mask);
+    
+    bool isChannelEnabledSnapshot (int ch);
     
     void setIntegerParamSuccess (int param, int value);
 };
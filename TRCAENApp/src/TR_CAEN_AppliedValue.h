@@ -0,0 +1,48 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+#ifndef TR_CAEN_APPLIED_VALUE_H
+#define TR_CAEN_APPLIED_VALUE_H
+
+// Remembers the value of a setting last applied to the digitizer, so that
+// applying the same value again can be skipped. The value is unknown
+// initially and after invalidate (e.g. when the digitizer was reset).
+template <typename ValueType>
+class TR_CAEN_AppliedValue {
+public:
+    TR_CAEN_AppliedValue ()
+    : m_valid(false),
+      m_value()
+    {}
+    
+    // Whether the value needs to be applied (it differs or is unknown).
+    bool needsApply (ValueType const &value) const
+    {
+        return !m_valid || !(m_value == value);
+    }
+    
+    // Records that the value was applied successfully.
+    void setApplied (ValueType const &value)
+    {
+        m_valid = true;
+        m_value = value;
+    }
+    
+    // Forgets the applied value (e.g. after a failure).
+    void invalidate ()
+    {
+        m_valid = false;
+    }
+
+private:
+    bool m_valid;
+    ValueType m_value;
+};
+
+#endif
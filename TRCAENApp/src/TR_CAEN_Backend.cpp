@@ -0,0 +1,245 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+#include <stdio.h>
+
+#include <string>
+#include <algorithm>
+
+#include <CAENComm.h>
+#include <CAENDigitizer.h>
+#include <CAENDigitizerType.h>
+
+#include "TR_CAEN_Backend.h"
+
+CAEN_DGTZ_ErrorCode TR_CAEN_Backend::multiReadRegisters (TR_CAEN_RegisterCycle *cycles, int num_cycles)
+{
+    CAEN_DGTZ_ErrorCode first_err = CAEN_DGTZ_Success;
+    
+    for (int i = 0; i < num_cycles; i++) {
+        cycles[i].err = readRegister(cycles[i].address, &cycles[i].value);
+        if (cycles[i].err != CAEN_DGTZ_Success && first_err == CAEN_DGTZ_Success) {
+            first_err = cycles[i].err;
+        }
+    }
+    
+    return first_err;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_Backend::multiWriteRegisters (TR_CAEN_RegisterCycle *cycles, int num_cycles)
+{
+    CAEN_DGTZ_ErrorCode first_err = CAEN_DGTZ_Success;
+    
+    for (int i = 0; i < num_cycles; i++) {
+        cycles[i].err = writeRegister(cycles[i].address, cycles[i].value);
+        if (cycles[i].err != CAEN_DGTZ_Success && first_err == CAEN_DGTZ_Success) {
+            first_err = cycles[i].err;
+        }
+    }
+    
+    return first_err;
+}
+
+static CAEN_DGTZ_ErrorCode commErrorToDgtz (CAENComm_ErrorCode err)
+{
+    switch (err) {
+        case CAENComm_Success:
+            return CAEN_DGTZ_Success;
+        case CAENComm_VMEBusError:
+        case CAENComm_CommError:
+        case CAENComm_CommTimeout:
+            return CAEN_DGTZ_CommError;
+        case CAENComm_InvalidParam:
+            return CAEN_DGTZ_InvalidParam;
+        default:
+            return CAEN_DGTZ_GenericError;
+    }
+}
+
+TR_CAEN_HwBackend::TR_CAEN_HwBackend (int link_number, int conet_node)
+:
+    m_link_number(link_number),
+    m_conet_node(conet_node),
+    m_handle(-1),
+    m_comm_state(CommUnknown),
+    m_comm_handle(-1)
+{
+}
+
+std::string TR_CAEN_HwBackend::getDescription ()
+{
+    char desc[64];
+    ::sprintf(desc, "link_number=%d conet_node=%d", m_link_number, m_conet_node);
+    return desc;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_HwBackend::open ()
+{
+    return CAEN_DGTZ_OpenDigitizer(CAEN_DGTZ_OpticalLink, m_link_number, m_conet_node, 0, &m_handle);
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_HwBackend::close ()
+{
+    // The CAENComm handle is closed with the digitizer.
+    m_comm_state = CommUnknown;
+    m_comm_handle = -1;
+    
+    return CAEN_DGTZ_CloseDigitizer(m_handle);
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_HwBackend::getInfo (CAEN_DGTZ_BoardInfo_t *info)
+{
+    return CAEN_DGTZ_GetInfo(m_handle, info);
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_HwBackend::reset ()
+{
+    return CAEN_DGTZ_Reset(m_handle);
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_HwBackend::calibrate ()
+{
+    return CAEN_DGTZ_Calibrate(m_handle);
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_HwBackend::readRegister (uint32_t address, uint32_t *value)
+{
+    return CAEN_DGTZ_ReadRegister(m_handle, address, value);
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_HwBackend::writeRegister (uint32_t address, uint32_t value)
+{
+    return CAEN_DGTZ_WriteRegister(m_handle, address, value);
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_HwBackend::multiReadRegisters (TR_CAEN_RegisterCycle *cycles, int num_cycles)
+{
+    return multiAccess(false, cycles, num_cycles);
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_HwBackend::multiWriteRegisters (TR_CAEN_RegisterCycle *cycles, int num_cycles)
+{
+    return multiAccess(true, cycles, num_cycles);
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_HwBackend::multiAccess (bool write, TR_CAEN_RegisterCycle *cycles, int num_cycles)
+{
+    if (m_comm_state == CommUnknown) {
+        CAEN_DGTZ_BoardInfo_t info;
+        CAEN_DGTZ_ErrorCode err = CAEN_DGTZ_GetInfo(m_handle, &info);
+        if (err == CAEN_DGTZ_Success && info.CommHandle >= 0) {
+            m_comm_handle = info.CommHandle;
+            m_comm_state = CommAvailable;
+        } else {
+            fprintf(stderr, "TR_CAEN_HwBackend Warning: No CAENComm handle of the digitizer (error %d), "
+                "register batches will use single accesses.\n", (int)err);
+            m_comm_state = CommUnavailable;
+        }
+    }
+    
+    if (m_comm_state != CommAvailable) {
+        return write ? TR_CAEN_Backend::multiWriteRegisters(cycles, num_cycles) :
+                       TR_CAEN_Backend::multiReadRegisters(cycles, num_cycles);
+    }
+    
+    CAEN_DGTZ_ErrorCode first_err = CAEN_DGTZ_Success;
+    
+    for (int start = 0; start < num_cycles; start += MaxCommCycles) {
+        int count = std::min(MaxCommCycles, num_cycles - start);
+        
+        uint32_t addresses[MaxCommCycles];
+        uint32_t data[MaxCommCycles];
+        CAENComm_ErrorCode errors[MaxCommCycles];
+        
+        for (int i = 0; i < count; i++) {
+            addresses[i] = cycles[start + i].address;
+            data[i] = cycles[start + i].value;
+            errors[i] = CAENComm_Success;
+        }
+        
+        CAENComm_ErrorCode ret = write ?
+            CAENComm_MultiWrite32(m_comm_handle, addresses, count, data, errors) :
+            CAENComm_MultiRead32(m_comm_handle, addresses, count, data, errors);
+        
+        for (int i = 0; i < count; i++) {
+            TR_CAEN_RegisterCycle &cycle = cycles[start + i];
+            cycle.err = commErrorToDgtz((ret != CAENComm_Success) ? ret : errors[i]);
+            if (!write) {
+                cycle.value = data[i];
+            }
+            if (cycle.err != CAEN_DGTZ_Success && first_err == CAEN_DGTZ_Success) {
+                first_err = cycle.err;
+            }
+        }
+    }
+    
+    return first_err;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_HwBackend::setAcquisitionMode (CAEN_DGTZ_AcqMode_t mode)
+{
+    return CAEN_DGTZ_SetAcquisitionMode(m_handle, mode);
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_HwBackend::setRecordLength (uint32_t record_length)
+{
+    return CAEN_DGTZ_SetRecordLength(m_handle, record_length);
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_HwBackend::setZeroSuppressionMode (CAEN_DGTZ_ZS_Mode_t mode)
+{
+    return CAEN_DGTZ_SetZeroSuppressionMode(m_handle, mode);
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_HwBackend::setChannelZSParams (uint32_t channel, CAEN_DGTZ_ThresholdWeight_t weight,
+                                                           int32_t threshold, int32_t nsamp)
+{
+    return CAEN_DGTZ_SetChannelZSParams(m_handle, channel, weight, threshold, nsamp);
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_HwBackend::setMaxNumEventsBLT (uint32_t num_events)
+{
+    return CAEN_DGTZ_SetMaxNumEventsBLT(m_handle, num_events);
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_HwBackend::setInterruptConfig (CAEN_DGTZ_EnaDis_t state, uint8_t level, uint32_t status_id,
+                                                           uint16_t event_number, CAEN_DGTZ_IRQMode_t mode)
+{
+    return CAEN_DGTZ_SetInterruptConfig(m_handle, state, level, status_id, event_number, mode);
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_HwBackend::swStartAcquisition ()
+{
+    return CAEN_DGTZ_SWStartAcquisition(m_handle);
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_HwBackend::swStopAcquisition ()
+{
+    return CAEN_DGTZ_SWStopAcquisition(m_handle);
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_HwBackend::mallocReadoutBuffer (char **buffer, uint32_t *size)
+{
+    return CAEN_DGTZ_MallocReadoutBuffer(m_handle, buffer, size);
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_HwBackend::freeReadoutBuffer (char **buffer)
+{
+    return CAEN_DGTZ_FreeReadoutBuffer(buffer);
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_HwBackend::readData (char *buffer, uint32_t *size)
+{
+    return CAEN_DGTZ_ReadData(m_handle, CAEN_DGTZ_SLAVE_TERMINATED_READOUT_MBLT, buffer, size);
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_HwBackend::irqWait (uint32_t timeout_ms)
+{
+    return CAEN_DGTZ_IRQWait(m_handle, timeout_ms);
+}
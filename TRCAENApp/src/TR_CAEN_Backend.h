@@ -0,0 +1,135 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+#ifndef TR_CAEN_BACKEND_H
+#define TR_CAEN_BACKEND_H
+
+#include <stdint.h>
+
+#include <string>
+
+#include <CAENDigitizerType.h>
+
+// One register access of a batch: the address, the value (written, or
+// read into) and the result of the access.
+struct TR_CAEN_RegisterCycle {
+    uint32_t address;
+    uint32_t value;
+    CAEN_DGTZ_ErrorCode err;
+};
+
+// Interface through which the driver accesses a digitizer. The functions
+// correspond to the CAEN digitizer library functions used by the driver
+// and return CAEN error codes, so that a backend which does not use the
+// hardware (e.g. a simulator) can be used in place of the library.
+//
+// The backend owns the device handle. Functions other than open may only
+// be called while the device is open.
+class TR_CAEN_Backend {
+public:
+    virtual ~TR_CAEN_Backend () {}
+    
+    // Returns a description of the device for messages.
+    virtual std::string getDescription () = 0;
+    
+    virtual CAEN_DGTZ_ErrorCode open () = 0;
+    virtual CAEN_DGTZ_ErrorCode close () = 0;
+    virtual CAEN_DGTZ_ErrorCode getInfo (CAEN_DGTZ_BoardInfo_t *info) = 0;
+    virtual CAEN_DGTZ_ErrorCode reset () = 0;
+    virtual CAEN_DGTZ_ErrorCode calibrate () = 0;
+    virtual CAEN_DGTZ_ErrorCode readRegister (uint32_t address, uint32_t *value) = 0;
+    virtual CAEN_DGTZ_ErrorCode writeRegister (uint32_t address, uint32_t value) = 0;
+    
+    // Read or write a batch of registers, setting the result of each cycle.
+    // Returns the first error of any cycle. The default implementations do
+    // one access per cycle, backends may do it in fewer link transactions.
+    virtual CAEN_DGTZ_ErrorCode multiReadRegisters (TR_CAEN_RegisterCycle *cycles, int num_cycles);
+    virtual CAEN_DGTZ_ErrorCode multiWriteRegisters (TR_CAEN_RegisterCycle *cycles, int num_cycles);
+    
+    virtual CAEN_DGTZ_ErrorCode setAcquisitionMode (CAEN_DGTZ_AcqMode_t mode) = 0;
+    virtual CAEN_DGTZ_ErrorCode setRecordLength (uint32_t record_length) = 0;
+    virtual CAEN_DGTZ_ErrorCode setZeroSuppressionMode (CAEN_DGTZ_ZS_Mode_t mode) = 0;
+    virtual CAEN_DGTZ_ErrorCode setChannelZSParams (uint32_t channel, CAEN_DGTZ_ThresholdWeight_t weight,
+                                                    int32_t threshold, int32_t nsamp) = 0;
+    virtual CAEN_DGTZ_ErrorCode setMaxNumEventsBLT (uint32_t num_events) = 0;
+    virtual CAEN_DGTZ_ErrorCode setInterruptConfig (CAEN_DGTZ_EnaDis_t state, uint8_t level, uint32_t status_id,
+                                                    uint16_t event_number, CAEN_DGTZ_IRQMode_t mode) = 0;
+    virtual CAEN_DGTZ_ErrorCode swStartAcquisition () = 0;
+    virtual CAEN_DGTZ_ErrorCode swStopAcquisition () = 0;
+    virtual CAEN_DGTZ_ErrorCode mallocReadoutBuffer (char **buffer, uint32_t *size) = 0;
+    virtual CAEN_DGTZ_ErrorCode freeReadoutBuffer (char **buffer) = 0;
+    
+    // Transfers data into a buffer from mallocReadoutBuffer, the number of
+    // bytes transferred is returned in *size.
+    virtual CAEN_DGTZ_ErrorCode readData (char *buffer, uint32_t *size) = 0;
+    
+    // Waits for an interrupt, returning CAEN_DGTZ_Timeout on timeout.
+    virtual CAEN_DGTZ_ErrorCode irqWait (uint32_t timeout_ms) = 0;
+    
+    // Returns whether the trigger time tags count in real time since
+    // swStartAcquisition, so that they can be related to the host time.
+    virtual bool timeTagsFollowHostTime () { return true; }
+};
+
+// Backend using the CAEN digitizer library with an optical link. Batches of
+// register accesses use the CAENComm multi read/write functions with the
+// CAENComm handle of the digitizer library (from CAEN_DGTZ_GetInfo), falling
+// back to single accesses if it is not available. Using the same handle,
+// these are serialized against the readout by CAENComm just like the single
+// register accesses of the digitizer library.
+class TR_CAEN_HwBackend : public TR_CAEN_Backend {
+public:
+    TR_CAEN_HwBackend (int link_number, int conet_node);
+    
+    std::string getDescription (); // override
+    
+    CAEN_DGTZ_ErrorCode open (); // override
+    CAEN_DGTZ_ErrorCode close (); // override
+    CAEN_DGTZ_ErrorCode getInfo (CAEN_DGTZ_BoardInfo_t *info); // override
+    CAEN_DGTZ_ErrorCode reset (); // override
+    CAEN_DGTZ_ErrorCode calibrate (); // override
+    CAEN_DGTZ_ErrorCode readRegister (uint32_t address, uint32_t *value); // override
+    CAEN_DGTZ_ErrorCode writeRegister (uint32_t address, uint32_t value); // override
+    CAEN_DGTZ_ErrorCode multiReadRegisters (TR_CAEN_RegisterCycle *cycles, int num_cycles); // override
+    CAEN_DGTZ_ErrorCode multiWriteRegisters (TR_CAEN_RegisterCycle *cycles, int num_cycles); // override
+    CAEN_DGTZ_ErrorCode setAcquisitionMode (CAEN_DGTZ_AcqMode_t mode); // override
+    CAEN_DGTZ_ErrorCode setRecordLength (uint32_t record_length); // override
+    CAEN_DGTZ_ErrorCode setZeroSuppressionMode (CAEN_DGTZ_ZS_Mode_t mode); // override
+    CAEN_DGTZ_ErrorCode setChannelZSParams (uint32_t channel, CAEN_DGTZ_ThresholdWeight_t weight,
+                                            int32_t threshold, int32_t nsamp); // override
+    CAEN_DGTZ_ErrorCode setMaxNumEventsBLT (uint32_t num_events); // override
+    CAEN_DGTZ_ErrorCode setInterruptConfig (CAEN_DGTZ_EnaDis_t state, uint8_t level, uint32_t status_id,
+                                            uint16_t event_number, CAEN_DGTZ_IRQMode_t mode); // override
+    CAEN_DGTZ_ErrorCode swStartAcquisition (); // override
+    CAEN_DGTZ_ErrorCode swStopAcquisition (); // override
+    CAEN_DGTZ_ErrorCode mallocReadoutBuffer (char **buffer, uint32_t *size); // override
+    CAEN_DGTZ_ErrorCode freeReadoutBuffer (char **buffer); // override
+    CAEN_DGTZ_ErrorCode readData (char *buffer, uint32_t *size); // override
+    CAEN_DGTZ_ErrorCode irqWait (uint32_t timeout_ms); // override
+
+private:
+    // Maximum number of cycles in one CAENComm multi read/write.
+    static int const MaxCommCycles = 64;
+    
+    CAEN_DGTZ_ErrorCode multiAccess (bool write, TR_CAEN_RegisterCycle *cycles, int num_cycles);
+    
+    int m_link_number;
+    int m_conet_node;
+    
+    // Device handle (valid while open).
+    int m_handle;
+    
+    // CAENComm handle for batched register accesses, owned by the digitizer
+    // library and taken on first use (valid if m_comm_state is CommAvailable).
+    enum CommState {CommUnknown, CommAvailable, CommUnavailable};
+    CommState m_comm_state;
+    int m_comm_handle;
+};
+
+#endif
@@ -0,0 +1,199 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "TR_CAEN_Decoder.h"
+#include "TR_CAEN_BitUtils.h"
+
+bool TR_CAEN_DecodeEventHeader (uint32_t const *data, size_t num_words, TR_CAEN_EventHeader *header)
+{
+    if (num_words < (size_t)TR_CAEN_EventHeaderWords) {
+        return false;
+    }
+    
+    // Word 0: 0xA tag in the top 4 bits, event size in the rest.
+    if (TR_CAEN_GetBits<uint32_t>(data[0], 28, 4) != 0xA) {
+        return false;
+    }
+    uint32_t size_words = TR_CAEN_GetBits<uint32_t>(data[0], 0, 28);
+    if (size_words < (uint32_t)TR_CAEN_EventHeaderWords || size_words > num_words) {
+        return false;
+    }
+    
+    header->size_words = size_words;
+    
+    // Word 1: board ID, board fail, ZLE flag, pattern, channel mask (bits 0-7).
+    header->board_id = TR_CAEN_GetBits<uint32_t>(data[1], 27, 5);
+    header->board_fail = TR_CAEN_GetBit(data[1], 26);
+    header->zle = TR_CAEN_GetBit(data[1], 24);
+    header->pattern = TR_CAEN_GetBits<uint32_t>(data[1], 8, 16);
+    
+    // Word 2: channel mask (bits 8-15), event counter.
+    header->channel_mask = TR_CAEN_GetBits<uint32_t>(data[1], 0, 8) |
+                           (TR_CAEN_GetBits<uint32_t>(data[2], 24, 8) << 8);
+    header->event_counter = TR_CAEN_GetBits<uint32_t>(data[2], 0, 24);
+    
+    // Word 3: trigger time tag.
+    header->trigger_time_tag = data[3];
+    
+    return true;
+}
+
+TR_CAEN_TimeTagExtender::TR_CAEN_TimeTagExtender ()
+: m_time_tag(0),
+  m_lag(0.0),
+  m_lag_elapsed_time(0.0)
+{}
+
+void TR_CAEN_TimeTagExtender::reset ()
+{
+    m_time_tag = 0;
+    m_lag = 0.0;
+    m_lag_elapsed_time = 0.0;
+}
+
+// Maximum drift rate between the host clock and the time tag counter, by
+// which the lag of the counter may grow.
+static double const TimeTagDriftRate = 1e-4;
+
+// Tolerance of the time tags being ahead of the host time (seconds), for the
+// drift since the lag was determined.
+static double const TimeTagTolerance = 1.0;
+
+uint64_t TR_CAEN_TimeTagExtender::extend (uint32_t trigger_time_tag, double elapsed_time, bool *ambiguous)
+{
+    uint64_t const counter_mask = ((uint64_t)1 << TR_CAEN_TimeTagBits) - 1;
+    uint64_t const period = counter_mask + 1;
+    
+    *ambiguous = false;
+    
+    // Bit 31 is a rollover flag and not part of the counter.
+    uint64_t counter = trigger_time_tag & counter_mask;
+    
+    // The earliest possible time tag is not before the previous event, the
+    // counter going backwards means that it rolled over.
+    uint64_t time_tag = (m_time_tag & ~counter_mask) | counter;
+    if (time_tag < m_time_tag) {
+        time_tag += period;
+    }
+    
+    if (elapsed_time >= 0.0) {
+        // The lag may have grown since it was determined.
+        double lag = m_lag + TimeTagDriftRate * (elapsed_time - m_lag_elapsed_time);
+        double max_time_tag = (elapsed_time - lag + TimeTagTolerance) * TR_CAEN_TimeTagFrequency;
+        
+        if ((double)time_tag > max_time_tag) {
+            // The host time is behind the previous events, keep the earliest.
+            *ambiguous = true;
+        } else {
+            // Take the latest time tag not after the host time, the counter
+            // may have rolled over during a gap between the events.
+            uint64_t missed_periods = (uint64_t)((max_time_tag - (double)time_tag) / period);
+            time_tag += missed_periods * period;
+            *ambiguous = missed_periods > 0;
+        }
+        
+        // Events read out late do not increase the lag.
+        m_lag = std::min(lag, elapsed_time - time_tag / TR_CAEN_TimeTagFrequency);
+        m_lag_elapsed_time = elapsed_time;
+    }
+    
+    m_time_tag = time_tag;
+    
+    return m_time_tag;
+}
+
+int TR_CAEN_CountEvents (uint32_t const *data, size_t num_words)
+{
+    int num_events = 0;
+    size_t pos = 0;
+    TR_CAEN_EventHeader header;
+    while (TR_CAEN_DecodeEventHeader(data + pos, num_words - pos, &header)) {
+        num_events++;
+        pos += header.size_words;
+    }
+    return num_events;
+}
+
+int TR_CAEN_EventNumChannels (TR_CAEN_EventHeader const &header)
+{
+    int num_channels = 0;
+    for (uint32_t mask = header.channel_mask; mask != 0; mask &= mask - 1) {
+        num_channels++;
+    }
+    return num_channels;
+}
+
+size_t TR_CAEN_EventNumSamples (TR_CAEN_EventHeader const &header)
+{
+    int num_channels = TR_CAEN_EventNumChannels(header);
+    if (num_channels == 0) {
+        return 0;
+    }
+    
+    // Each channel gets the same number of words, with two samples per word.
+    size_t data_words = header.size_words - TR_CAEN_EventHeaderWords;
+    return 2 * (data_words / num_channels);
+}
+
+bool TR_CAEN_DecodeZleChannel (uint32_t const *data, size_t num_words,
+    std::vector<TR_CAEN_ZleSegment> &segments, size_t *ch_words, size_t *record_samples)
+{
+    segments.clear();
+    
+    // The first word is the size of the channel data including itself.
+    if (num_words < 1) {
+        return false;
+    }
+    size_t size_words = TR_CAEN_GetBits<uint32_t>(data[0], 0, 22);
+    if (size_words < 1 || size_words > num_words) {
+        return false;
+    }
+    
+    // The rest are control words, each followed by the stored data words
+    // in case of a "good" control word, or nothing for a "skip" control word.
+    size_t pos = 1;
+    size_t sample_offset = 0;
+    while (pos < size_words) {
+        uint32_t control = data[pos++];
+        bool good = TR_CAEN_GetBit(control, 31);
+        size_t count_words = TR_CAEN_GetBits<uint32_t>(control, 0, 21);
+        
+        if (good) {
+            if (count_words > size_words - pos) {
+                return false;
+            }
+            
+            // Each block is a separate segment, even if it follows the
+            // previous one in the record, since its data does not follow
+            // the previous data (the control word is in between).
+            if (count_words > 0) {
+                TR_CAEN_ZleSegment segment;
+                segment.sample_offset = sample_offset;
+                segment.num_samples = 2 * count_words;
+                segment.data = data + pos;
+                segments.push_back(segment);
+            }
+            
+            pos += count_words;
+        }
+        
+        sample_offset += 2 * count_words;
+    }
+    
+    *ch_words = size_words;
+    *record_samples = sample_offset;
+    
+    return true;
+}
@@ -0,0 +1,117 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+#ifndef TR_CAEN_DECODER_H
+#define TR_CAEN_DECODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+// Number of 32-bit words in the header of an event.
+static int const TR_CAEN_EventHeaderWords = 4;
+
+// Number of bits of the trigger time tag counter.
+static int const TR_CAEN_TimeTagBits = 31;
+
+// Frequency of the trigger time tag counter (8 ns units).
+static double const TR_CAEN_TimeTagFrequency = 125e6;
+
+// Information from the header of an event in the raw board data.
+struct TR_CAEN_EventHeader {
+    // Size of the event including the header, in 32-bit words.
+    uint32_t size_words;
+    
+    // Board ID (GEO address).
+    uint32_t board_id;
+    
+    // Board failure flag.
+    bool board_fail;
+    
+    // Whether the channel data is in the ZLE (zero length encoding) format.
+    bool zle;
+    
+    // LVDS pattern latched with the trigger.
+    uint32_t pattern;
+    
+    // Mask of channels present in the event.
+    uint32_t channel_mask;
+    
+    // Event counter (24 bits).
+    uint32_t event_counter;
+    
+    // Trigger time tag (31 bits plus the rollover flag in bit 31).
+    uint32_t trigger_time_tag;
+};
+
+// A segment of stored ("good") samples of a channel in ZLE format.
+struct TR_CAEN_ZleSegment {
+    // Offset of the first sample of the segment within the record.
+    size_t sample_offset;
+    
+    // Number of samples in the segment.
+    size_t num_samples;
+    
+    // Packed sample data of the segment (two samples per word).
+    uint32_t const *data;
+};
+
+// Extends the trigger time tags of consecutive events to 64 bits by detecting
+// rollovers of the counter, which is reset when the acquisition is started.
+// From the time tags alone, rollovers are missed if consecutive events are
+// more than one counter period (about 17 s) apart. For such gaps, the number
+// of rollovers is estimated from the host time when the event was processed,
+// taking the latest time tag not after it (as if the event was read out
+// without delay). The lag of the counter behind the host time, e.g. due to
+// clock drift, is tracked as the minimum over the events.
+class TR_CAEN_TimeTagExtender {
+public:
+    TR_CAEN_TimeTagExtender ();
+    
+    // Starts over, for when the counter was reset.
+    void reset ();
+    
+    // Returns the extended time tag for the trigger time tag of the next event.
+    // elapsed_time is the host time since the counter was reset (seconds), or
+    // negative if unknown, then only the time tags are used. *ambiguous is set
+    // if the number of rollovers is not determined by the time tags, i.e. it
+    // depends on the event not having been read out late, or the host time is
+    // inconsistent with the time tags.
+    uint64_t extend (uint32_t trigger_time_tag, double elapsed_time, bool *ambiguous);
+
+private:
+    uint64_t m_time_tag;
+    double m_lag;
+    double m_lag_elapsed_time;
+};
+
+// Decodes the event header at the start of data, which has num_words words
+// available. Returns false if there is no valid event at this position.
+bool TR_CAEN_DecodeEventHeader (uint32_t const *data, size_t num_words, TR_CAEN_EventHeader *header);
+
+// Returns the number of consecutive valid events at the start of data,
+// which has num_words words available.
+int TR_CAEN_CountEvents (uint32_t const *data, size_t num_words);
+
+// Returns the number of channels present in the event.
+int TR_CAEN_EventNumChannels (TR_CAEN_EventHeader const &header);
+
+// Returns the number of samples per channel in an event (uncompressed format).
+size_t TR_CAEN_EventNumSamples (TR_CAEN_EventHeader const &header);
+
+// Decodes the ZLE data of one channel at the start of data, which has num_words
+// words available. The stored segments are returned in segments (cleared first),
+// the size of the channel data in *ch_words and the number of samples of the
+// whole record (stored and skipped) in *record_samples. Returns false if the
+// data is not valid.
+bool TR_CAEN_DecodeZleChannel (uint32_t const *data, size_t num_words,
+    std::vector<TR_CAEN_ZleSegment> &segments, size_t *ch_words, size_t *record_samples);
+
+#endif
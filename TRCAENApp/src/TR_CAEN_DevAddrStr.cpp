@@ -11,6 +11,8 @@
 #include <stdlib.h>
 
 #include <string>
+#include <vector>
+#include <algorithm>
 
 #include "TR_CAEN_DevAddrStr.h"
 
@@ -25,7 +27,21 @@ static long int str_strtol (std::string const &str, size_t *idx, int base)
     return res;
 }
 
-bool TR_CAEN_ParseAddrStr (std::string const &addr_str, int *link_number, int *conet_node)
+// Highest CONET node number on a link (daisy chain of up to 8 digitizers).
+static int const MaxConetNode = 7;
+
+static bool parse_node (std::string const &str, int *node)
+{
+    size_t idx;
+    long int value = str_strtol(str, &idx, 0);
+    if (str.empty() || idx != str.size() || value < 0 || value > MaxConetNode) {
+        return false;
+    }
+    *node = value;
+    return true;
+}
+
+bool TR_CAEN_ParseAddrListStr (std::string const &addr_str, int *link_number, std::vector<int> *conet_nodes)
 {
     size_t idx;
     
@@ -40,10 +56,45 @@ bool TR_CAEN_ParseAddrStr (std::string const &addr_str, int *link_number, int *c
         return false;
     }
     
-    std::string conet_node_str = addr_str.substr(delim_pos + 1);
-    *conet_node = str_strtol(conet_node_str, &idx, 0);
-    if (idx != conet_node_str.size()) {
-        return false;
+    conet_nodes->clear();
+    
+    // Parse the comma-separated items, each a node or a range of nodes.
+    size_t item_pos = delim_pos + 1;
+    while (true) {
+        size_t item_end = addr_str.find(',', item_pos);
+        if (item_end == std::string::npos) {
+            item_end = addr_str.size();
+        }
+        std::string item_str = addr_str.substr(item_pos, item_end - item_pos);
+        
+        int first_node;
+        int last_node;
+        size_t range_pos = item_str.find('-');
+        if (range_pos == std::string::npos) {
+            if (!parse_node(item_str, &first_node)) {
+                return false;
+            }
+            last_node = first_node;
+        } else {
+            if (!parse_node(item_str.substr(0, range_pos), &first_node) ||
+                !parse_node(item_str.substr(range_pos + 1), &last_node) ||
+                last_node < first_node)
+            {
+                return false;
+            }
+        }
+        
+        for (int node = first_node; node <= last_node; node++) {
+            if (std::find(conet_nodes->begin(), conet_nodes->end(), node) != conet_nodes->end()) {
+                return false;
+            }
+            conet_nodes->push_back(node);
+        }
+        
+        if (item_end == addr_str.size()) {
+            break;
+        }
+        item_pos = item_end + 1;
     }
     
     return true;
@@ -11,7 +11,11 @@
 #define TR_CAEN_DEV_ADDR_STR_H
 
 #include <string>
+#include <vector>
 
-bool TR_CAEN_ParseAddrStr (std::string const &addr_str, int *link_number, int *conet_node);
+// Parses an address with a list of CONET nodes on one link, for example
+// "0:0-7" or "0:0,1,2". The nodes must be in the range 0-7 and must not
+// repeat.
+bool TR_CAEN_ParseAddrListStr (std::string const &addr_str, int *link_number, std::vector<int> *conet_nodes);
 
 #endif
@@ -0,0 +1,159 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "TR_CAEN_EventGen.h"
+#include "TR_CAEN_BitUtils.h"
+#include "TR_CAEN_Decoder.h"
+
+static double const Pi = 3.14159265358979323846;
+
+// Largest 14-bit sample value.
+static int const MaxSampleValue = 16383;
+
+int TR_CAEN_EventGenShapeFromName (std::string const &name)
+{
+    if (name == "pulse") {
+        return TR_CAEN_EventGenConfig::ShapePulse;
+    }
+    if (name == "sine") {
+        return TR_CAEN_EventGenConfig::ShapeSine;
+    }
+    if (name == "ramp") {
+        return TR_CAEN_EventGenConfig::ShapeRamp;
+    }
+    if (name == "flat") {
+        return TR_CAEN_EventGenConfig::ShapeFlat;
+    }
+    return -1;
+}
+
+TR_CAEN_EventGen::TR_CAEN_EventGen ()
+:
+    m_random_state(1),
+    m_channel_mask(0),
+    m_body_words(0),
+    m_next_variant(0)
+{
+}
+
+void TR_CAEN_EventGen::setConfig (TR_CAEN_EventGenConfig const &config)
+{
+    m_config = config;
+}
+
+void TR_CAEN_EventGen::prepare (uint32_t channel_mask, size_t record_length, size_t trigger_offset)
+{
+    m_random_state = (m_config.seed != 0) ? m_config.seed : 1;
+    m_channel_mask = channel_mask & 0xFFFF;
+    m_next_variant = 0;
+    
+    int num_channels = 0;
+    for (int ch = 0; ch < 16; ch++) {
+        num_channels += TR_CAEN_GetBit(m_channel_mask, ch);
+    }
+    
+    size_t ch_words = record_length / 2;
+    m_body_words = num_channels * ch_words;
+    m_bodies.resize(NumVariants * m_body_words);
+    
+    for (int variant = 0; variant < NumVariants; variant++) {
+        uint32_t *body = &m_bodies[variant * m_body_words];
+        
+        for (int ch_index = 0; ch_index < num_channels; ch_index++) {
+            uint32_t *ch_data = body + ch_index * ch_words;
+            double phase = (nextRandom() & 0xFFFF) / 65536.0;
+            
+            for (size_t i = 0; i < ch_words; i++) {
+                uint32_t word = 0;
+                for (int half = 0; half < 2; half++) {
+                    double value = waveformSample(2 * i + half, trigger_offset, phase) +
+                                   m_config.noise * nextGaussian();
+                    int sample = std::max(0, std::min(MaxSampleValue, (int)std::floor(value + 0.5)));
+                    word |= (uint32_t)sample << (16 * half);
+                }
+                ch_data[i] = word;
+            }
+        }
+    }
+}
+
+size_t TR_CAEN_EventGen::getEventWords () const
+{
+    return TR_CAEN_EventHeaderWords + m_body_words;
+}
+
+void TR_CAEN_EventGen::generateEvent (uint32_t *out, uint32_t board_id, uint32_t event_counter, uint32_t trigger_time_tag)
+{
+    uint32_t size_words = getEventWords();
+    
+    out[0] = (0xAu << 28) | (size_words & 0x0FFFFFFF);
+    out[1] = ((board_id & 0x1F) << 27) | (m_channel_mask & 0xFF);
+    out[2] = ((m_channel_mask >> 8) << 24) | (event_counter & 0xFFFFFF);
+    out[3] = trigger_time_tag;
+    
+    if (m_body_words > 0) {
+        ::memcpy(out + TR_CAEN_EventHeaderWords, &m_bodies[m_next_variant * m_body_words],
+                 m_body_words * sizeof(uint32_t));
+    }
+    
+    m_next_variant = (m_next_variant + 1) % NumVariants;
+}
+
+uint32_t TR_CAEN_EventGen::nextRandom ()
+{
+    // xorshift32
+    uint32_t x = m_random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    m_random_state = x;
+    return x;
+}
+
+double TR_CAEN_EventGen::nextGaussian ()
+{
+    // Sum of uniform variables, scaled to unit variance.
+    double sum = 0.0;
+    for (int i = 0; i < 4; i++) {
+        sum += nextRandom() / 4294967296.0;
+    }
+    return (sum - 2.0) * std::sqrt(3.0);
+}
+
+double TR_CAEN_EventGen::waveformSample (size_t index, size_t trigger_offset, double phase)
+{
+    double period = std::max(1.0, m_config.period);
+    double t = (double)index;
+    
+    switch (m_config.shape) {
+        case TR_CAEN_EventGenConfig::ShapePulse:
+            if (index < trigger_offset) {
+                return m_config.baseline;
+            }
+            return m_config.baseline + m_config.amplitude * std::exp(-(t - trigger_offset) / period);
+        
+        case TR_CAEN_EventGenConfig::ShapeSine:
+            return m_config.baseline + m_config.amplitude * std::sin(2.0 * Pi * (t / period + phase));
+        
+        case TR_CAEN_EventGenConfig::ShapeRamp:
+            return m_config.baseline + m_config.amplitude * (std::fmod(t, period) / period);
+        
+        default:
+            return m_config.baseline;
+    }
+}
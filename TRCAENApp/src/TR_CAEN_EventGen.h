@@ -0,0 +1,104 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+#ifndef TR_CAEN_EVENT_GEN_H
+#define TR_CAEN_EVENT_GEN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// Parameters of the synthetic waveforms.
+struct TR_CAEN_EventGenConfig {
+    // Waveform shapes.
+    enum Shape {
+        ShapePulse, // exponential decay starting at the trigger, time constant = period
+        ShapeSine,  // sine wave with the given period, random phase
+        ShapeRamp,  // sawtooth with the given period
+        ShapeFlat   // baseline only (plus noise)
+    };
+    
+    TR_CAEN_EventGenConfig ()
+    : shape(ShapePulse),
+      baseline(8192.0),
+      amplitude(4000.0),
+      period(64.0),
+      noise(4.0),
+      seed(1)
+    {}
+    
+    int shape;
+    
+    // Baseline and amplitude (ADC counts, the amplitude may be negative).
+    double baseline;
+    double amplitude;
+    
+    // Period or time constant (samples).
+    double period;
+    
+    // RMS of the noise (ADC counts).
+    double noise;
+    
+    // Seed of the pseudo-random number generator.
+    uint32_t seed;
+};
+
+// Returns the shape with the given name ("pulse", "sine", "ramp", "flat"),
+// or -1 if the name is not known.
+int TR_CAEN_EventGenShapeFromName (std::string const &name);
+
+// Generates events in the raw (uncompressed) x730 board data format.
+//
+// To make generating events cheap enough for benchmarks, prepare computes
+// a small number of variants of the channel data (differing in noise and
+// phase), and each generated event copies one of them after the header.
+class TR_CAEN_EventGen {
+public:
+    TR_CAEN_EventGen ();
+    
+    void setConfig (TR_CAEN_EventGenConfig const &config);
+    
+    // Prepares for generating events with the given channels and record
+    // length (must be even). The trigger is at trigger_offset samples
+    // into the record.
+    void prepare (uint32_t channel_mask, size_t record_length, size_t trigger_offset);
+    
+    // Returns the size of each event in 32-bit words.
+    size_t getEventWords () const;
+    
+    // Writes one event of getEventWords words to out.
+    void generateEvent (uint32_t *out, uint32_t board_id, uint32_t event_counter, uint32_t trigger_time_tag);
+
+private:
+    // Number of variants of the channel data.
+    static int const NumVariants = 16;
+    
+    uint32_t nextRandom ();
+    double nextGaussian ();
+    double waveformSample (size_t index, size_t trigger_offset, double phase);
+    
+    TR_CAEN_EventGenConfig m_config;
+    
+    // Pseudo-random number generator state.
+    uint32_t m_random_state;
+    
+    // Channel mask and size of the channel data of each event (words).
+    uint32_t m_channel_mask;
+    size_t m_body_words;
+    
+    // The variants of the channel data.
+    std::vector<uint32_t> m_bodies;
+    
+    // Variant used for the next event.
+    int m_next_variant;
+};
+
+#endif
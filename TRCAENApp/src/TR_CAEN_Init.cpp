@@ -10,11 +10,20 @@
 #include <stddef.h>
 #include <stdio.h>
 
+#include <string>
+#include <vector>
+
 #include <epicsThread.h>
 #include <epicsExport.h>
 #include <iocsh.h>
 
 #include "TR_CAEN.h"
+#include "TR_CAEN_Backend.h"
+#include "TR_CAEN_DevAddrStr.h"
+#include "TR_CAEN_LinkScheduler.h"
+#include "TR_CAEN_ReplayBackend.h"
+#include "TR_CAEN_SimBackend.h"
+#include "TR_CAEN_ThreadPool.h"
 
 extern "C" int TR_CAEN_InitDevice(
     char const *port_name, char const *device_addr_str,
@@ -28,12 +37,77 @@ extern "C" int TR_CAEN_InitDevice(
         return 1;
     }
     
-    TR_CAEN *driver = new TR_CAEN(
-        port_name, device_addr_str, read_thread_prio_epics, read_thread_stack_size,
-        max_ad_buffers, max_ad_memory);
+    // Simulated and replayed digitizers are selected with a "sim" or
+    // "replay" address and are read out by their own link scheduler.
+    bool simulated = TR_CAEN_IsSimAddrStr(device_addr_str);
+    bool replayed = TR_CAEN_IsReplayAddrStr(device_addr_str);
+    TR_CAEN_SimConfig sim_config;
+    TR_CAEN_ReplayConfig replay_config;
     
-    driver->completeInit();
+    int link_number;
+    std::vector<int> conet_nodes;
+    if (simulated) {
+        if (!TR_CAEN_ParseSimAddrStr(device_addr_str, &sim_config)) {
+            fprintf(stderr, "TR_CAEN_InitDevice Error: bad simulated device address string.\n");
+            return 1;
+        }
+        link_number = TR_CAEN_SimLinkNumber;
+        for (int board = 0; board < sim_config.num_boards; board++) {
+            conet_nodes.push_back(board);
+        }
+    }
+    else if (replayed) {
+        if (!TR_CAEN_ParseReplayAddrStr(device_addr_str, &replay_config)) {
+            fprintf(stderr, "TR_CAEN_InitDevice Error: bad replay device address string.\n");
+            return 1;
+        }
+        link_number = TR_CAEN_SimLinkNumber;
+        conet_nodes.push_back(0);
+    }
+    else if (!TR_CAEN_ParseAddrListStr(device_addr_str, &link_number, &conet_nodes)) {
+        fprintf(stderr, "TR_CAEN_InitDevice Error: bad device address string.\n");
+        return 1;
+    }
     
+    // In pool mode, the digitizers on the link share the worker thread.
+    TRWorkerThread *shared_worker = TR_CAEN_ThreadPool::getWorkerForLink(link_number);
+    
+    // All digitizers on the link are read out by the same scheduler thread.
+    TR_CAEN_LinkScheduler *link_scheduler = TR_CAEN_LinkScheduler::getForLink(
+        link_number, read_thread_prio_epics, read_thread_stack_size);
+    
+    // Create a driver for each digitizer. With multiple nodes, the port
+    // names are suffixed with the node number.
+    for (size_t i = 0; i < conet_nodes.size(); i++) {
+        char node_suffix[20];
+        ::sprintf(node_suffix, "_%d", conet_nodes[i]);
+        std::string node_port_name = std::string(port_name) + ((conet_nodes.size() > 1) ? node_suffix : "");
+        
+        TR_CAEN_Backend *backend;
+        std::string node_addr_str;
+        if (simulated) {
+            backend = new TR_CAEN_SimBackend(sim_config, conet_nodes[i]);
+            node_addr_str = std::string(device_addr_str) + ((conet_nodes.size() > 1) ? node_suffix : "");
+        }
+        else if (replayed) {
+            backend = new TR_CAEN_ReplayBackend(replay_config);
+            node_addr_str = device_addr_str;
+        }
+        else {
+            char addr_buf[40];
+            ::sprintf(addr_buf, "%d:%d", link_number, conet_nodes[i]);
+            backend = new TR_CAEN_HwBackend(link_number, conet_nodes[i]);
+            node_addr_str = addr_buf;
+        }
+        
+        TR_CAEN *driver = new TR_CAEN(
+            node_port_name.c_str(), node_addr_str.c_str(), backend, link_scheduler, shared_worker,
+            read_thread_prio_epics, read_thread_stack_size,
+            max_ad_buffers, max_ad_memory);
+        
+        driver->completeInit();
+    }
+
 #if 0
     if (!driver->Open()) {
         fprintf(stderr, "TR_CAEN_InitDevice Error: Failed to connect with driver.\n");
@@ -46,7 +120,7 @@ extern "C" int TR_CAEN_InitDevice(
 }
 
 static const iocshArg initArg0 = {"port name", iocshArgString};
-static const iocshArg initArg1 = {"device node", iocshArgString};
+static const iocshArg initArg1 = {"device node(s)", iocshArgString};
 static const iocshArg initArg2 = {"read thread priority (EPICS units)", iocshArgInt};
 static const iocshArg initArg3 = {"read thread stack size", iocshArgInt};
 static const iocshArg initArg4 = {"max AreaDetector buffers", iocshArgInt};
@@ -60,10 +134,63 @@ static void initCallFunc(const iocshArgBuf *args)
                        args[3].ival, args[4].ival, args[5].ival);
 }
 
+extern "C" int TR_CAEN_ConfigurePool(
+    char const *link_cpus, int worker_thread_prio_epics, int worker_thread_stack_size)
+{
+    if (worker_thread_prio_epics < epicsThreadPriorityMin || worker_thread_prio_epics > epicsThreadPriorityMax) {
+        fprintf(stderr, "TR_CAEN_ConfigurePool Error: parameters are not valid.\n");
+        return 1;
+    }
+    
+    return TR_CAEN_ThreadPool::configure(link_cpus, worker_thread_prio_epics, worker_thread_stack_size) ? 0 : 1;
+}
+
+static const iocshArg poolArg0 = {"link to CPU map (e.g. 0:2,1:3)", iocshArgString};
+static const iocshArg poolArg1 = {"worker thread priority (EPICS units)", iocshArgInt};
+static const iocshArg poolArg2 = {"worker thread stack size", iocshArgInt};
+static const iocshArg * const poolArgs[] = {&poolArg0, &poolArg1, &poolArg2};
+static const iocshFuncDef poolFuncDef = {"TR_CAEN_ConfigurePool", 3, poolArgs};
+
+static void poolCallFunc(const iocshArgBuf *args)
+{
+    TR_CAEN_ConfigurePool(args[0].sval, args[1].ival, args[2].ival);
+}
+
+extern "C" int TR_CAEN_RegisterReport(char const *port_name, int reset)
+{
+    if (port_name == NULL) {
+        fprintf(stderr, "TR_CAEN_RegisterReport Error: port name is not given.\n");
+        return 1;
+    }
+    
+    asynPortDriver *port_driver = static_cast<asynPortDriver *>(findAsynPortDriver(port_name));
+    TR_CAEN *driver = dynamic_cast<TR_CAEN *>(port_driver);
+    if (driver == NULL) {
+        fprintf(stderr, "TR_CAEN_RegisterReport Error: %s is not a TR_CAEN port.\n", port_name);
+        return 1;
+    }
+    
+    driver->registerReport(stdout, reset != 0);
+    
+    return 0;
+}
+
+static const iocshArg regReportArg0 = {"port name", iocshArgString};
+static const iocshArg regReportArg1 = {"reset (0/1)", iocshArgInt};
+static const iocshArg * const regReportArgs[] = {&regReportArg0, &regReportArg1};
+static const iocshFuncDef regReportFuncDef = {"TR_CAEN_RegisterReport", 2, regReportArgs};
+
+static void regReportCallFunc(const iocshArgBuf *args)
+{
+    TR_CAEN_RegisterReport(args[0].sval, args[1].ival);
+}
+
 extern "C" {
     void TR_CAEN_Register(void)
     {
         iocshRegister(&initFuncDef, initCallFunc);
+        iocshRegister(&poolFuncDef, poolCallFunc);
+        iocshRegister(&regReportFuncDef, regReportCallFunc);
     }
     epicsExportRegistrar(TR_CAEN_Register);
 }
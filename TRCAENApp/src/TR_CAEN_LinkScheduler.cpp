@@ -0,0 +1,175 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include <string>
+#include <map>
+#include <algorithm>
+
+#include <epicsGuard.h>
+#include <epicsThread.h>
+
+#include "TR_CAEN_LinkScheduler.h"
+#include "TR_CAEN_ThreadPool.h"
+
+double const TR_CAEN_LinkScheduler::PollInterval = 0.001;
+
+// Schedulers by link number, created on demand and never destroyed.
+static epicsMutex *link_schedulers_mutex = NULL;
+static std::map<int, TR_CAEN_LinkScheduler *> link_schedulers;
+
+static void createLinkSchedulersMutex (void *)
+{
+    link_schedulers_mutex = new epicsMutex();
+}
+
+TR_CAEN_LinkScheduler * TR_CAEN_LinkScheduler::getForLink (int link_number, int thread_prio_epics, int thread_stack_size)
+{
+    static epicsThreadOnceId once = EPICS_THREAD_ONCE_INIT;
+    epicsThreadOnce(&once, createLinkSchedulersMutex, NULL);
+    
+    epicsGuard<epicsMutex> lock(*link_schedulers_mutex);
+    
+    std::map<int, TR_CAEN_LinkScheduler *>::iterator it = link_schedulers.find(link_number);
+    if (it != link_schedulers.end()) {
+        return it->second;
+    }
+    
+    TR_CAEN_LinkScheduler *scheduler = new TR_CAEN_LinkScheduler(link_number, thread_prio_epics, thread_stack_size);
+    link_schedulers[link_number] = scheduler;
+    
+    return scheduler;
+}
+
+static std::string linkThreadName (int link_number)
+{
+    char name[20];
+    ::sprintf(name, "TRlink:%d", link_number);
+    return std::string(name);
+}
+
+TR_CAEN_LinkScheduler::TR_CAEN_LinkScheduler (int link_number, int thread_prio_epics, int thread_stack_size)
+:
+    m_link_number(link_number),
+    m_poll_start(0),
+    m_thread(*this, linkThreadName(link_number).c_str(),
+        (thread_stack_size > 0) ? thread_stack_size : epicsThreadGetStackSize(epicsThreadStackMedium),
+        thread_prio_epics)
+{
+    m_thread.start();
+}
+
+int TR_CAEN_LinkScheduler::getLinkNumber () const
+{
+    return m_link_number;
+}
+
+void TR_CAEN_LinkScheduler::activate (TR_CAEN_LinkClient *client)
+{
+    {
+        epicsGuard<epicsMutex> lock(m_mutex);
+        m_active_clients.push_back(client);
+    }
+    
+    m_wakeup.signal();
+}
+
+void TR_CAEN_LinkScheduler::wakeup ()
+{
+    m_wakeup.signal();
+}
+
+void TR_CAEN_LinkScheduler::run ()
+{
+    // Pin to the CPU configured for the link, if any.
+    TR_CAEN_ThreadPool::pinCurrentThread(TR_CAEN_ThreadPool::getCpuForLink(m_link_number));
+    
+    while (true) {
+        // Take a copy of the active clients. Only this thread removes
+        // clients, others may add them concurrently.
+        {
+            epicsGuard<epicsMutex> lock(m_mutex);
+            m_clients = m_active_clients;
+        }
+        
+        if (m_clients.empty()) {
+            m_wakeup.wait();
+            continue;
+        }
+        
+        // Service the client with the most buffered events, if any is known
+        // to have events. Clients with a stop request report a large number
+        // so that they are handled promptly.
+        TR_CAEN_LinkClient *best_client = NULL;
+        int best_pending = 0;
+        for (size_t i = 0; i < m_clients.size(); i++) {
+            int pending = m_clients[i]->linkPendingEvents();
+            if (pending > best_pending) {
+                best_client = m_clients[i];
+                best_pending = pending;
+            }
+        }
+        
+        if (best_client != NULL) {
+            handleStepResult(best_client, best_client->linkReadoutStep());
+            continue;
+        }
+        
+        // No client is known to have events, poll all of them, starting
+        // with a different one each time.
+        bool got_data = false;
+        TR_CAEN_LinkClient *irq_client = NULL;
+        
+        size_t num_clients = m_clients.size();
+        m_poll_start = (m_poll_start + 1) % num_clients;
+        
+        for (size_t i = 0; i < num_clients; i++) {
+            TR_CAEN_LinkClient *client = m_clients[(m_poll_start + i) % num_clients];
+            TR_CAEN_LinkClient::StepResult result = client->linkReadoutStep();
+            handleStepResult(client, result);
+            
+            if (result == TR_CAEN_LinkClient::StepData) {
+                got_data = true;
+            }
+            else if (result == TR_CAEN_LinkClient::StepNoData && irq_client == NULL && client->linkUsesIrq()) {
+                irq_client = client;
+            }
+        }
+        
+        if (got_data) {
+            continue;
+        }
+        
+        // Nothing was transferred, wait for data. The interrupt line is
+        // shared by the digitizers on the link, so waiting for the interrupt
+        // of any one of them also covers the others.
+        if (irq_client != NULL) {
+            irq_client->linkWaitForIrq();
+        } else {
+            m_wakeup.wait(PollInterval);
+        }
+    }
+}
+
+void TR_CAEN_LinkScheduler::handleStepResult (TR_CAEN_LinkClient *client, TR_CAEN_LinkClient::StepResult result)
+{
+    if (result != TR_CAEN_LinkClient::StepStopped) {
+        return;
+    }
+    
+    {
+        epicsGuard<epicsMutex> lock(m_mutex);
+        m_active_clients.erase(std::remove(m_active_clients.begin(), m_active_clients.end(), client),
+                               m_active_clients.end());
+    }
+    
+    client->linkReadoutStopped();
+}
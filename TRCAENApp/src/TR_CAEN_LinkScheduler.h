@@ -0,0 +1,101 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+#ifndef TR_CAEN_LINK_SCHEDULER_H
+#define TR_CAEN_LINK_SCHEDULER_H
+
+#include <vector>
+
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsThread.h>
+
+// Interface of a digitizer whose readout is serviced by a TR_CAEN_LinkScheduler.
+// All functions are called from the scheduler thread only.
+class TR_CAEN_LinkClient {
+public:
+    // Result of a readout step.
+    enum StepResult {
+        StepData,    // data was transferred
+        StepNoData,  // the digitizer had no data
+        StepBlocked, // no free readout buffer, nothing was done
+        StepStopped  // the readout is stopped (requested or due to an error)
+    };
+    
+    // Performs one data transfer from the digitizer if possible.
+    virtual StepResult linkReadoutStep () = 0;
+    
+    // Returns the estimated number of events buffered in the digitizer which
+    // can be transferred now (0 if unknown or no readout buffer is free).
+    virtual int linkPendingEvents () = 0;
+    
+    // Returns whether the digitizer raises interrupts when it has data.
+    virtual bool linkUsesIrq () = 0;
+    
+    // Waits for an interrupt from the digitizer (with a short timeout).
+    // On error, the next linkReadoutStep returns StepStopped.
+    virtual void linkWaitForIrq () = 0;
+    
+    // Called after the client was removed from the scheduler due to
+    // linkReadoutStep returning StepStopped.
+    virtual void linkReadoutStopped () = 0;
+};
+
+// Services the readout of all digitizers connected to one link from a
+// single thread. It repeatedly transfers data from the digitizer with the
+// most buffered events, and when no digitizer is known to have events it
+// polls all of them in turn. There is one scheduler per link.
+class TR_CAEN_LinkScheduler : private epicsThreadRunable {
+public:
+    // Returns the scheduler for the link, creating it if needed. The thread
+    // priority and stack size are used when the scheduler is created.
+    static TR_CAEN_LinkScheduler * getForLink (int link_number, int thread_prio_epics, int thread_stack_size);
+    
+    // Returns the link number.
+    int getLinkNumber () const;
+    
+    // Adds a client to the set of clients being serviced.
+    void activate (TR_CAEN_LinkClient *client);
+    
+    // Wakes up the scheduler (a client got a free readout buffer or a stop request).
+    void wakeup ();
+
+private:
+    // How long to wait before polling again when no client has data (seconds).
+    static double const PollInterval;
+    
+    TR_CAEN_LinkScheduler (int link_number, int thread_prio_epics, int thread_stack_size);
+    
+    void run (); // override
+    
+    void handleStepResult (TR_CAEN_LinkClient *client, TR_CAEN_LinkClient::StepResult result);
+    
+    // The link number.
+    int m_link_number;
+    
+    // Protects m_active_clients.
+    epicsMutex m_mutex;
+    
+    // Clients being serviced.
+    std::vector<TR_CAEN_LinkClient *> m_active_clients;
+    
+    // Copy of m_active_clients used by the scheduler thread.
+    std::vector<TR_CAEN_LinkClient *> m_clients;
+    
+    // Index of the client to poll first, rotated for fairness.
+    size_t m_poll_start;
+    
+    // Event signaled to wake up the scheduler.
+    epicsEvent m_wakeup;
+    
+    // The scheduler thread.
+    epicsThread m_thread;
+};
+
+#endif
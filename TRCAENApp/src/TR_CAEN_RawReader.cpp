@@ -0,0 +1,197 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "TR_CAEN_RawReader.h"
+
+static char const RawFileMagic[] = "TRCAENRAW1\n";
+
+TR_CAEN_RawReader::TR_CAEN_RawReader ()
+:
+    m_fd(-1),
+    m_chunk_size(0),
+    m_chunk_pos(0),
+    m_chunk_end(0),
+    m_next_chunk_offset(0),
+    m_error(false)
+{
+}
+
+TR_CAEN_RawReader::~TR_CAEN_RawReader ()
+{
+    close();
+}
+
+bool TR_CAEN_RawReader::open (std::string const &file_path)
+{
+    close();
+    
+    int fd = ::open(file_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "TR_CAEN_RawReader Error: failed to open %s: %s.\n",
+            file_path.c_str(), strerror(errno));
+        return false;
+    }
+    
+    std::vector<char> header_block(TR_CAEN_RawFileHeaderSize + 1, '\0');
+    if (::pread(fd, &header_block[0], TR_CAEN_RawFileHeaderSize, 0) != (ssize_t)TR_CAEN_RawFileHeaderSize ||
+        ::memcmp(&header_block[0], RawFileMagic, sizeof(RawFileMagic) - 1) != 0)
+    {
+        fprintf(stderr, "TR_CAEN_RawReader Error: %s is not a raw recording.\n", file_path.c_str());
+        ::close(fd);
+        return false;
+    }
+    
+    // Parse the "key=value" lines following the magic line.
+    m_header.clear();
+    char const *pos = &header_block[sizeof(RawFileMagic) - 1];
+    while (*pos != '\0') {
+        char const *line_end = ::strchr(pos, '\n');
+        if (line_end == NULL) {
+            break;
+        }
+        std::string line(pos, line_end - pos);
+        size_t eq_pos = line.find('=');
+        if (eq_pos != std::string::npos) {
+            m_header[line.substr(0, eq_pos)] = line.substr(eq_pos + 1);
+        }
+        pos = line_end + 1;
+    }
+    
+    m_fd = fd;
+    
+    int chunk_size = getHeaderInt("chunk_size", 0);
+    if (chunk_size <= (int)sizeof(TR_CAEN_RawChunkHeader)) {
+        fprintf(stderr, "TR_CAEN_RawReader Error: bad chunk size in %s.\n", file_path.c_str());
+        close();
+        return false;
+    }
+    
+    m_chunk_size = chunk_size;
+    m_chunk.resize(m_chunk_size);
+    
+    rewind();
+    
+    return true;
+}
+
+void TR_CAEN_RawReader::close ()
+{
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+bool TR_CAEN_RawReader::isOpen () const
+{
+    return m_fd >= 0;
+}
+
+std::string TR_CAEN_RawReader::getHeaderValue (std::string const &key, std::string const &def) const
+{
+    std::map<std::string, std::string>::const_iterator it = m_header.find(key);
+    return (it != m_header.end()) ? it->second : def;
+}
+
+int TR_CAEN_RawReader::getHeaderInt (std::string const &key, int def) const
+{
+    std::string str = getHeaderValue(key, "");
+    char *end;
+    long value = ::strtol(str.c_str(), &end, 0);
+    return (!str.empty() && *end == '\0') ? (int)value : def;
+}
+
+size_t TR_CAEN_RawReader::getMaxRecordSize () const
+{
+    return m_chunk_size - sizeof(TR_CAEN_RawChunkHeader) - sizeof(TR_CAEN_RawRecordHeader);
+}
+
+void TR_CAEN_RawReader::rewind ()
+{
+    m_chunk_pos = 0;
+    m_chunk_end = 0;
+    m_next_chunk_offset = TR_CAEN_RawFileHeaderSize;
+    m_error = false;
+}
+
+bool TR_CAEN_RawReader::nextRecord (TR_CAEN_RawRecordHeader *header, char const **data)
+{
+    if (m_fd < 0 || m_error) {
+        return false;
+    }
+    
+    // Move on to the next chunk when this one has no more records
+    // (chunks may in principle be empty).
+    while (m_chunk_pos + sizeof(TR_CAEN_RawRecordHeader) > m_chunk_end) {
+        if (!readChunk()) {
+            return false;
+        }
+    }
+    
+    ::memcpy(header, &m_chunk[m_chunk_pos], sizeof(*header));
+    
+    size_t data_pos = m_chunk_pos + sizeof(TR_CAEN_RawRecordHeader);
+    if (header->size_bytes > m_chunk_end - data_pos) {
+        fprintf(stderr, "TR_CAEN_RawReader Error: record exceeds the chunk.\n");
+        m_error = true;
+        return false;
+    }
+    
+    *data = &m_chunk[data_pos];
+    m_chunk_pos = data_pos + header->size_bytes;
+    
+    return true;
+}
+
+bool TR_CAEN_RawReader::hadError () const
+{
+    return m_error;
+}
+
+bool TR_CAEN_RawReader::readChunk ()
+{
+    ssize_t res = ::pread(m_fd, &m_chunk[0], m_chunk_size, m_next_chunk_offset);
+    if (res == 0) {
+        return false;
+    }
+    if (res != (ssize_t)m_chunk_size) {
+        fprintf(stderr, "TR_CAEN_RawReader Error: short or failed read of a chunk.\n");
+        m_error = true;
+        return false;
+    }
+    
+    TR_CAEN_RawChunkHeader chunk_header;
+    ::memcpy(&chunk_header, &m_chunk[0], sizeof(chunk_header));
+    if (chunk_header.magic != TR_CAEN_RawChunkMagic ||
+        chunk_header.payload_bytes > m_chunk_size - sizeof(TR_CAEN_RawChunkHeader))
+    {
+        fprintf(stderr, "TR_CAEN_RawReader Error: bad chunk header.\n");
+        m_error = true;
+        return false;
+    }
+    
+    m_next_chunk_offset += m_chunk_size;
+    m_chunk_pos = sizeof(TR_CAEN_RawChunkHeader);
+    m_chunk_end = m_chunk_pos + chunk_header.payload_bytes;
+    
+    return true;
+}
@@ -0,0 +1,75 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+#ifndef TR_CAEN_RAW_READER_H
+#define TR_CAEN_RAW_READER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "TR_CAEN_RawRecorder.h"
+
+// Reads the records of a file written by TR_CAEN_RawRecorder, in order.
+class TR_CAEN_RawReader {
+public:
+    TR_CAEN_RawReader ();
+    ~TR_CAEN_RawReader ();
+    
+    // Opens the file and parses the header. Returns false on error.
+    bool open (std::string const &file_path);
+    
+    void close ();
+    
+    bool isOpen () const;
+    
+    // Returns the value of a header key, or def if the key is not present.
+    std::string getHeaderValue (std::string const &key, std::string const &def) const;
+    int getHeaderInt (std::string const &key, int def) const;
+    
+    // Returns the largest possible record data size (bounded by the chunk size).
+    size_t getMaxRecordSize () const;
+    
+    // Goes back to the first record.
+    void rewind ();
+    
+    // Reads the next record. On success, the record header is returned in
+    // *header and the data pointer in *data, which is valid until the next
+    // call. Returns false at the end of the file or on error (see hadError).
+    bool nextRecord (TR_CAEN_RawRecordHeader *header, char const **data);
+    
+    bool hadError () const;
+
+private:
+    bool readChunk ();
+    
+    int m_fd;
+    
+    // Header values.
+    std::map<std::string, std::string> m_header;
+    
+    size_t m_chunk_size;
+    
+    // The current chunk, the position of the next record in it and the
+    // end of its payload.
+    std::vector<char> m_chunk;
+    size_t m_chunk_pos;
+    size_t m_chunk_end;
+    
+    // File offset of the next chunk.
+    off_t m_next_chunk_offset;
+    
+    bool m_error;
+};
+
+#endif
@@ -0,0 +1,338 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string>
+#include <algorithm>
+
+#include <epicsAtomic.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+
+#include "TR_CAEN_RawRecorder.h"
+
+static char const RawFileMagic[] = "TRCAENRAW1\n";
+
+static size_t roundUp (size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static void formatTime (epicsTimeStamp const &ts, char *buf, size_t buf_size)
+{
+    epicsTimeToStrftime(buf, buf_size, "%Y-%m-%dT%H:%M:%S.%06f", &ts);
+}
+
+TR_CAEN_RawRecorder::TR_CAEN_RawRecorder (std::string const &thread_name, int thread_prio_epics, int thread_stack_size)
+:
+    m_fd(-1),
+    m_chunk_size(0),
+    m_header_block(NULL),
+    m_fill_bytes(0),
+    m_fill_records(0),
+    m_next_sequence(0),
+    m_dropped_since_record(0),
+    m_chunks_submitted(0),
+    m_chunks_processed(0),
+    m_chunks_written(0),
+    m_records_dropped(0),
+    m_write_error(0),
+    m_thread(*this, thread_name.c_str(),
+        (thread_stack_size > 0) ? thread_stack_size : epicsThreadGetStackSize(epicsThreadStackMedium),
+        thread_prio_epics),
+    m_thread_started(false)
+{
+}
+
+bool TR_CAEN_RawRecorder::open (std::string const &file_path, std::string const &header_text, size_t max_record_size,
+                                int num_chunks)
+{
+    if (m_fd >= 0) {
+        return false;
+    }
+    
+    // The header text must fit into the header block along with the magic
+    // line and the lines added when closing.
+    if (sizeof(RawFileMagic) + header_text.size() + 256 > TR_CAEN_RawFileHeaderSize) {
+        fprintf(stderr, "TR_CAEN_RawRecorder Error: header is too large.\n");
+        return false;
+    }
+    
+    // Start the writer thread on first use.
+    if (!m_thread_started) {
+        m_thread.start();
+        m_thread_started = true;
+    }
+    
+    // Allocate the buffers, chunks must fit the largest record.
+    size_t chunk_size = roundUp(std::max(MinChunkSize,
+        sizeof(TR_CAEN_RawChunkHeader) + sizeof(TR_CAEN_RawRecordHeader) + max_record_size), Alignment);
+    
+    num_chunks = std::max(MinNumChunks, std::min(MaxNumChunks, num_chunks));
+    
+    if (chunk_size != m_chunk_size || (size_t)num_chunks != m_chunk_buffers.size()) {
+        for (size_t i = 0; i < m_chunk_buffers.size(); i++) {
+            ::free(m_chunk_buffers[i]);
+        }
+        m_chunk_buffers.clear();
+        m_chunk_size = 0;
+        
+        for (int i = 0; i < num_chunks; i++) {
+            void *ptr;
+            if (::posix_memalign(&ptr, Alignment, chunk_size) != 0) {
+                fprintf(stderr, "TR_CAEN_RawRecorder Error: failed to allocate chunk buffers.\n");
+                return false;
+            }
+            m_chunk_buffers.push_back((char *)ptr);
+        }
+        m_chunk_size = chunk_size;
+    }
+    
+    if (m_header_block == NULL) {
+        void *ptr;
+        if (::posix_memalign(&ptr, Alignment, TR_CAEN_RawFileHeaderSize) != 0) {
+            fprintf(stderr, "TR_CAEN_RawRecorder Error: failed to allocate header block.\n");
+            return false;
+        }
+        m_header_block = (char *)ptr;
+    }
+    
+    // Create the file, using O_DIRECT unless the file system does not support it.
+    int flags = O_WRONLY | O_CREAT | O_EXCL;
+    int fd = ::open(file_path.c_str(), flags | O_DIRECT, 0644);
+    if (fd < 0 && errno == EINVAL) {
+        fd = ::open(file_path.c_str(), flags, 0644);
+    }
+    if (fd < 0) {
+        fprintf(stderr, "TR_CAEN_RawRecorder Error: failed to create %s: %s.\n",
+            file_path.c_str(), strerror(errno));
+        return false;
+    }
+    
+    m_fd = fd;
+    m_header_text = header_text;
+    epicsTimeGetCurrent(&m_start_time);
+    
+    m_fill_bytes = sizeof(TR_CAEN_RawChunkHeader);
+    m_fill_records = 0;
+    m_next_sequence = 0;
+    m_dropped_since_record = 0;
+    epicsAtomicSetIntT(&m_chunks_submitted, 0);
+    epicsAtomicSetIntT(&m_chunks_processed, 0);
+    epicsAtomicSetIntT(&m_chunks_written, 0);
+    epicsAtomicSetIntT(&m_records_dropped, 0);
+    epicsAtomicSetIntT(&m_write_error, 0);
+    
+    if (!writeHeader(false)) {
+        ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+    
+    return true;
+}
+
+void TR_CAEN_RawRecorder::write (void const *data, size_t size)
+{
+    size_t record_bytes = sizeof(TR_CAEN_RawRecordHeader) + size;
+    
+    // Hand over the chunk to the writer if the record does not fit.
+    if (m_fill_bytes + record_bytes > m_chunk_size) {
+        int pending = m_chunks_submitted - epicsAtomicGetIntT(&m_chunks_processed);
+        if (pending >= (int)m_chunk_buffers.size() - 1) {
+            // All other chunk buffers are waiting to be written.
+            m_dropped_since_record++;
+            epicsAtomicIncrIntT(&m_records_dropped);
+            return;
+        }
+        submitChunk();
+    }
+    
+    epicsTimeStamp now;
+    epicsTimeGetCurrent(&now);
+    
+    TR_CAEN_RawRecordHeader header;
+    header.size_bytes = size;
+    header.dropped = m_dropped_since_record;
+    header.host_sec = now.secPastEpoch + POSIX_TIME_AT_EPICS_EPOCH;
+    header.host_nsec = now.nsec;
+    
+    char *chunk = m_chunk_buffers[m_chunks_submitted % m_chunk_buffers.size()];
+    ::memcpy(chunk + m_fill_bytes, &header, sizeof(header));
+    ::memcpy(chunk + m_fill_bytes + sizeof(header), data, size);
+    
+    m_fill_bytes += record_bytes;
+    m_fill_records++;
+    m_dropped_since_record = 0;
+}
+
+bool TR_CAEN_RawRecorder::close ()
+{
+    if (m_fd < 0) {
+        return true;
+    }
+    
+    // Write out the last chunk if it has any records.
+    if (m_fill_records > 0) {
+        submitChunk();
+    }
+    waitChunksWritten();
+    
+    writeHeader(true);
+    
+    if (::close(m_fd) != 0) {
+        epicsAtomicSetIntT(&m_write_error, 1);
+    }
+    m_fd = -1;
+    
+    return !epicsAtomicGetIntT(&m_write_error);
+}
+
+bool TR_CAEN_RawRecorder::isOpen () const
+{
+    return m_fd >= 0;
+}
+
+double TR_CAEN_RawRecorder::getBytesWritten () const
+{
+    return TR_CAEN_RawFileHeaderSize + (double)epicsAtomicGetIntT(&m_chunks_written) * m_chunk_size;
+}
+
+int TR_CAEN_RawRecorder::getRecordsDropped () const
+{
+    return epicsAtomicGetIntT(&m_records_dropped);
+}
+
+bool TR_CAEN_RawRecorder::hadError () const
+{
+    return epicsAtomicGetIntT(&m_write_error);
+}
+
+void TR_CAEN_RawRecorder::run ()
+{
+    while (true) {
+        m_write_request.wait();
+        
+        // Write all submitted chunks in order.
+        int processed;
+        while ((processed = epicsAtomicGetIntT(&m_chunks_processed)) != epicsAtomicGetIntT(&m_chunks_submitted)) {
+            epicsAtomicReadMemoryBarrier();
+            
+            // Write the whole chunk, including the padding, to keep writes aligned.
+            if (!epicsAtomicGetIntT(&m_write_error)) {
+                char const *chunk = m_chunk_buffers[processed % m_chunk_buffers.size()];
+                if (writeAll(chunk, m_chunk_size)) {
+                    epicsAtomicIncrIntT(&m_chunks_written);
+                } else {
+                    epicsAtomicSetIntT(&m_write_error, 1);
+                }
+            }
+            
+            epicsAtomicIncrIntT(&m_chunks_processed);
+            m_write_done.signal();
+        }
+    }
+}
+
+bool TR_CAEN_RawRecorder::writeAll (char const *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t res = ::write(m_fd, data, size);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "TR_CAEN_RawRecorder Error: write failed: %s.\n", strerror(errno));
+            return false;
+        }
+        data += res;
+        size -= res;
+    }
+    return true;
+}
+
+void TR_CAEN_RawRecorder::submitChunk ()
+{
+    // Complete the chunk header and zero the padding.
+    char *chunk = m_chunk_buffers[m_chunks_submitted % m_chunk_buffers.size()];
+    
+    TR_CAEN_RawChunkHeader header;
+    header.magic = TR_CAEN_RawChunkMagic;
+    header.sequence = m_next_sequence++;
+    header.payload_bytes = m_fill_bytes - sizeof(TR_CAEN_RawChunkHeader);
+    header.num_records = m_fill_records;
+    ::memcpy(chunk, &header, sizeof(header));
+    ::memset(chunk + m_fill_bytes, 0, m_chunk_size - m_fill_bytes);
+    
+    // Pass it to the writer thread and continue with the next buffer.
+    epicsAtomicWriteMemoryBarrier();
+    epicsAtomicIncrIntT(&m_chunks_submitted);
+    m_write_request.signal();
+    
+    m_fill_bytes = sizeof(TR_CAEN_RawChunkHeader);
+    m_fill_records = 0;
+}
+
+void TR_CAEN_RawRecorder::waitChunksWritten ()
+{
+    while (epicsAtomicGetIntT(&m_chunks_processed) != m_chunks_submitted) {
+        m_write_done.wait();
+    }
+}
+
+bool TR_CAEN_RawRecorder::writeHeader (bool final)
+{
+    std::string text(RawFileMagic);
+    
+    char line[128];
+    char time_str[64];
+    
+    ::sprintf(line, "chunk_size=%lu\n", (unsigned long)m_chunk_size);
+    text += line;
+    
+    formatTime(m_start_time, time_str, sizeof(time_str));
+    ::sprintf(line, "start_time=%s\n", time_str);
+    text += line;
+    
+    text += m_header_text;
+    
+    if (final) {
+        epicsTimeStamp now;
+        epicsTimeGetCurrent(&now);
+        formatTime(now, time_str, sizeof(time_str));
+        ::sprintf(line, "stop_time=%s\nnum_chunks=%u\nrecords_dropped=%d\n",
+            time_str, (unsigned int)m_next_sequence, epicsAtomicGetIntT(&m_records_dropped));
+        text += line;
+    }
+    
+    ::memset(m_header_block, 0, TR_CAEN_RawFileHeaderSize);
+    ::memcpy(m_header_block, text.data(), std::min(text.size(), TR_CAEN_RawFileHeaderSize));
+    
+    if (::pwrite(m_fd, m_header_block, TR_CAEN_RawFileHeaderSize, 0) != (ssize_t)TR_CAEN_RawFileHeaderSize) {
+        fprintf(stderr, "TR_CAEN_RawRecorder Error: writing the header failed: %s.\n", strerror(errno));
+        epicsAtomicSetIntT(&m_write_error, 1);
+        return false;
+    }
+    
+    // Chunks follow the header block.
+    if (!final && ::lseek(m_fd, TR_CAEN_RawFileHeaderSize, SEEK_SET) < 0) {
+        epicsAtomicSetIntT(&m_write_error, 1);
+        return false;
+    }
+    
+    return true;
+}
@@ -0,0 +1,152 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+#ifndef TR_CAEN_RAW_RECORDER_H
+#define TR_CAEN_RAW_RECORDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+
+// Streams raw readout buffers to a file.
+//
+// File format (all integers little-endian):
+// - A header block of TR_CAEN_RawFileHeaderSize bytes: the magic line
+//   "TRCAENRAW1\n" followed by "key=value\n" lines describing the digitizer
+//   and the configuration, padded with zeros. It is rewritten when the file
+//   is closed, adding the stop time and totals.
+// - Chunks of the chunk_size given in the header, each starting with a
+//   TR_CAEN_RawChunkHeader followed by records. Each record is a
+//   TR_CAEN_RawRecordHeader followed by the data of one ReadData. The rest
+//   of the chunk after payload_bytes is padding.
+//
+// Records are added from one thread (the producer) with write, and whole
+// chunks are written in order by a writer thread from a ring of chunk
+// buffers, so the producer does not wait for the disk. The buffers absorb
+// disk latency spikes of up to (num_chunks - 1) chunks of data. If all other
+// buffers are still waiting to be written when a chunk is full, new records
+// are dropped as a whole until the writer frees a buffer. Dropped records
+// are counted in total and in the dropped field of the next record. O_DIRECT
+// is used if the file system supports it.
+
+// Size of the file header block.
+static size_t const TR_CAEN_RawFileHeaderSize = 4096;
+
+// Magic value of a chunk header ("CHNK").
+static uint32_t const TR_CAEN_RawChunkMagic = 0x4B4E4843u;
+
+struct TR_CAEN_RawChunkHeader {
+    uint32_t magic;
+    uint32_t sequence;      // chunk number starting from 0
+    uint32_t payload_bytes; // bytes of records following the chunk header
+    uint32_t num_records;
+};
+
+struct TR_CAEN_RawRecordHeader {
+    uint32_t size_bytes;    // size of the data following the record header
+    uint32_t dropped;       // number of records dropped before this one
+    uint32_t host_sec;      // host time when the data was read (POSIX seconds)
+    uint32_t host_nsec;
+};
+
+class TR_CAEN_RawRecorder : private epicsThreadRunable {
+public:
+    TR_CAEN_RawRecorder (std::string const &thread_name, int thread_prio_epics, int thread_stack_size);
+    
+    // Creates the file, which must not exist, and writes the header. The header text consists of
+    // "key=value\n" lines. max_record_size is the largest size passed to
+    // write. num_chunks is the number of chunk buffers (limited to
+    // MinNumChunks to MaxNumChunks). Returns false on error.
+    bool open (std::string const &file_path, std::string const &header_text, size_t max_record_size,
+               int num_chunks);
+    
+    // Adds a record (producer only, while open).
+    void write (void const *data, size_t size);
+    
+    // Writes the remaining data, rewrites the header and closes the file.
+    // The producer must not call write concurrently. Returns false if there
+    // was any write error since open.
+    bool close ();
+    
+    // Whether a file is open.
+    bool isOpen () const;
+    
+    // Limits of the number of chunk buffers.
+    static int const MinNumChunks = 2;
+    static int const MaxNumChunks = 64;
+    
+    // Statistics since open, may be read at any time.
+    double getBytesWritten () const;
+    int getRecordsDropped () const;
+    bool hadError () const;
+
+private:
+    // Alignment of buffers and writes, suitable for O_DIRECT.
+    static size_t const Alignment = 4096;
+    
+    // Minimum size of a chunk.
+    static size_t const MinChunkSize = 4 * 1024 * 1024;
+    
+    void run (); // override
+    
+    bool writeAll (char const *data, size_t size);
+    void submitChunk ();
+    void waitChunksWritten ();
+    bool writeHeader (bool final);
+    
+    // File descriptor (-1 if not open).
+    int m_fd;
+    
+    // Size of each chunk.
+    size_t m_chunk_size;
+    
+    // Header block and the ring of chunk buffers (aligned). Chunk number n
+    // is filled into buffer n % m_chunk_buffers.size().
+    char *m_header_block;
+    std::vector<char *> m_chunk_buffers;
+    
+    // The header text given to open and the time of opening.
+    std::string m_header_text;
+    epicsTimeStamp m_start_time;
+    
+    // Fill level of the chunk buffer being filled by the producer.
+    size_t m_fill_bytes;
+    uint32_t m_fill_records;
+    uint32_t m_next_sequence;
+    
+    // Records dropped since the last record added.
+    uint32_t m_dropped_since_record;
+    
+    // Numbers of chunks submitted by the producer and processed by the
+    // writer thread (accessed atomically). The chunks in between are waiting
+    // to be written, the next one is being filled.
+    int m_chunks_submitted;
+    int m_chunks_processed;
+    
+    // Statistics (accessed atomically).
+    int m_chunks_written;
+    int m_records_dropped;
+    int m_write_error;
+    
+    // Events to request a write and to report that it is done.
+    epicsEvent m_write_request;
+    epicsEvent m_write_done;
+    
+    // Writer thread and whether it is started.
+    epicsThread m_thread;
+    bool m_thread_started;
+};
+
+#endif
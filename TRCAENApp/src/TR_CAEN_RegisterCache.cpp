@@ -0,0 +1,68 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+#include "TR_CAEN_RegisterCache.h"
+
+void TR_CAEN_RegisterCache::addRegister (TR_CAEN_Register const &reg)
+{
+    if (m_entries.count(reg.reg_addr) != 0) {
+        return;
+    }
+    
+    Entry entry;
+    entry.valid = false;
+    entry.value = 0;
+    m_entries[reg.reg_addr] = entry;
+    m_registers.push_back(&reg);
+}
+
+std::vector<TR_CAEN_Register const *> const & TR_CAEN_RegisterCache::getRegisters () const
+{
+    return m_registers;
+}
+
+bool TR_CAEN_RegisterCache::isShadowed (TR_CAEN_Register const &reg) const
+{
+    return m_entries.count(reg.reg_addr) != 0;
+}
+
+bool TR_CAEN_RegisterCache::get (TR_CAEN_Register const &reg, uint32_t *out_value) const
+{
+    EntryMap::const_iterator it = m_entries.find(reg.reg_addr);
+    if (it == m_entries.end() || !it->second.valid) {
+        return false;
+    }
+    
+    *out_value = it->second.value;
+    return true;
+}
+
+void TR_CAEN_RegisterCache::set (TR_CAEN_Register const &reg, uint32_t value)
+{
+    EntryMap::iterator it = m_entries.find(reg.reg_addr);
+    if (it != m_entries.end()) {
+        it->second.valid = true;
+        it->second.value = value;
+    }
+}
+
+void TR_CAEN_RegisterCache::invalidate (TR_CAEN_Register const &reg)
+{
+    EntryMap::iterator it = m_entries.find(reg.reg_addr);
+    if (it != m_entries.end()) {
+        it->second.valid = false;
+    }
+}
+
+void TR_CAEN_RegisterCache::invalidateAll ()
+{
+    for (EntryMap::iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
+        it->second.valid = false;
+    }
+}
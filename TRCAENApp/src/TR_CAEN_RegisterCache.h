@@ -0,0 +1,58 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+#ifndef TR_CAEN_REGISTER_CACHE_H
+#define TR_CAEN_REGISTER_CACHE_H
+
+#include <stdint.h>
+
+#include <map>
+#include <vector>
+
+#include "TR_CAEN_Registers.h"
+
+// Shadow copy of registers which are only changed by the driver, so that
+// bit-field updates and readbacks do not need to read the register.
+// The set of registers is fixed after construction. The cache does no
+// locking, the user must serialize access to the values.
+class TR_CAEN_RegisterCache {
+public:
+    // Adds a register to be shadowed (only before the cache is used).
+    void addRegister (TR_CAEN_Register const &reg);
+    
+    // Returns the shadowed registers.
+    std::vector<TR_CAEN_Register const *> const & getRegisters () const;
+    
+    // Whether the register is shadowed.
+    bool isShadowed (TR_CAEN_Register const &reg) const;
+    
+    // Gets the cached value. Returns false if the register is not shadowed
+    // or its value is not known.
+    bool get (TR_CAEN_Register const &reg, uint32_t *out_value) const;
+    
+    // Sets the cached value (ignored if the register is not shadowed).
+    void set (TR_CAEN_Register const &reg, uint32_t value);
+    
+    // Marks the value as not known.
+    void invalidate (TR_CAEN_Register const &reg);
+    void invalidateAll ();
+
+private:
+    struct Entry {
+        bool valid;
+        uint32_t value;
+    };
+    
+    typedef std::map<uint32_t, Entry> EntryMap;
+    
+    std::vector<TR_CAEN_Register const *> m_registers;
+    EntryMap m_entries;
+};
+
+#endif
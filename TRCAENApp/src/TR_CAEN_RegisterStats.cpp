@@ -0,0 +1,274 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+
+#include <epicsAtomic.h>
+
+#include "TR_CAEN_RegisterStats.h"
+
+TR_CAEN_RegisterStats::TR_CAEN_RegisterStats ()
+{
+    ::memset(m_registers, 0, sizeof(m_registers));
+    m_untracked_ops = 0;
+    m_ops = 0;
+    m_errors = 0;
+    ::memset(m_error_codes, 0, sizeof(m_error_codes));
+    ::memset(m_latency_hist, 0, sizeof(m_latency_hist));
+}
+
+uint64_t TR_CAEN_RegisterStats::now ()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+void TR_CAEN_RegisterStats::record (char const *reg_name, uint32_t reg_addr, bool write,
+                                    uint64_t latency_ns, CAEN_DGTZ_ErrorCode err)
+{
+    epicsAtomicIncrSizeT(&m_latency_hist[getLatencyBucket(latency_ns)]);
+    
+    RegisterEntry *entry = countAccess(reg_name, reg_addr, write, err);
+    if (entry == NULL) {
+        return;
+    }
+    
+    epicsAtomicAddSizeT(&entry->latency_sum_ns, latency_ns);
+    
+    size_t max_ns = epicsAtomicGetSizeT(&entry->latency_max_ns);
+    while (latency_ns > max_ns) {
+        size_t old_max_ns = epicsAtomicCmpAndSwapSizeT(&entry->latency_max_ns, max_ns, latency_ns);
+        if (old_max_ns == max_ns) {
+            break;
+        }
+        max_ns = old_max_ns;
+    }
+}
+
+void TR_CAEN_RegisterStats::recordBatched (char const *reg_name, uint32_t reg_addr, bool write,
+                                           CAEN_DGTZ_ErrorCode err)
+{
+    RegisterEntry *entry = countAccess(reg_name, reg_addr, write, err);
+    if (entry != NULL) {
+        epicsAtomicIncrSizeT(&entry->batched);
+    }
+}
+
+void TR_CAEN_RegisterStats::recordBatch (uint64_t latency_ns)
+{
+    epicsAtomicIncrSizeT(&m_latency_hist[getLatencyBucket(latency_ns)]);
+}
+
+TR_CAEN_RegisterStats::RegisterEntry * TR_CAEN_RegisterStats::countAccess (
+    char const *reg_name, uint32_t reg_addr, bool write, CAEN_DGTZ_ErrorCode err)
+{
+    epicsAtomicIncrSizeT(&m_ops);
+    
+    if (err != CAEN_DGTZ_Success) {
+        int code_index = -(int)err;
+        if (code_index < 0 || code_index >= MaxErrorCodes) {
+            code_index = MaxErrorCodes - 1;
+        }
+        epicsAtomicIncrSizeT(&m_errors);
+        epicsAtomicIncrSizeT(&m_error_codes[code_index]);
+    }
+    
+    RegisterEntry *entry = getEntry(reg_name, reg_addr);
+    if (entry == NULL) {
+        epicsAtomicIncrSizeT(&m_untracked_ops);
+        return NULL;
+    }
+    
+    epicsAtomicIncrSizeT(write ? &entry->writes : &entry->reads);
+    if (err != CAEN_DGTZ_Success) {
+        epicsAtomicIncrSizeT(&entry->errors);
+    }
+    
+    return entry;
+}
+
+void TR_CAEN_RegisterStats::getSnapshot (Snapshot *out) const
+{
+    out->ops = epicsAtomicGetSizeT(&m_ops);
+    out->errors = epicsAtomicGetSizeT(&m_errors);
+    for (int i = 0; i < NumLatencyBuckets; i++) {
+        out->latency_hist[i] = epicsAtomicGetSizeT(&m_latency_hist[i]);
+    }
+}
+
+double TR_CAEN_RegisterStats::getLatencyPercentile (Snapshot const &prev, Snapshot const &cur, double fraction)
+{
+    // Counters going backwards means the statistics were reset, then
+    // the whole current histogram is used.
+    bool was_reset = cur.ops < prev.ops;
+    
+    size_t counts[NumLatencyBuckets];
+    size_t total = 0;
+    for (int i = 0; i < NumLatencyBuckets; i++) {
+        counts[i] = (was_reset || cur.latency_hist[i] < prev.latency_hist[i]) ?
+            cur.latency_hist[i] : (cur.latency_hist[i] - prev.latency_hist[i]);
+        total += counts[i];
+    }
+    
+    if (total == 0) {
+        return 0.0;
+    }
+    
+    // Find the bucket containing the percentile and interpolate within it.
+    double target = fraction * total;
+    double cumulative = 0.0;
+    for (int i = 0; i < NumLatencyBuckets; i++) {
+        if (counts[i] == 0) {
+            continue;
+        }
+        if (cumulative + counts[i] >= target) {
+            double bucket_start = (double)((uint64_t)1 << i);
+            return bucket_start + bucket_start * (target - cumulative) / counts[i];
+        }
+        cumulative += counts[i];
+    }
+    
+    return (double)((uint64_t)1 << NumLatencyBuckets);
+}
+
+void TR_CAEN_RegisterStats::report (FILE *out, TR_CAEN_ErrorCodes &error_codes) const
+{
+    Snapshot snapshot;
+    getSnapshot(&snapshot);
+    
+    fprintf(out, "Register accesses: %lu, errors: %lu\n",
+            (unsigned long)snapshot.ops, (unsigned long)snapshot.errors);
+    
+    Snapshot empty;
+    ::memset(&empty, 0, sizeof(empty));
+    fprintf(out, "Latency per transaction: p50 %.1f us, p99 %.1f us, p99.9 %.1f us\n",
+            getLatencyPercentile(empty, snapshot, 0.5) / 1e3,
+            getLatencyPercentile(empty, snapshot, 0.99) / 1e3,
+            getLatencyPercentile(empty, snapshot, 0.999) / 1e3);
+    
+    fprintf(out, "%-28s %6s %10s %10s %10s %8s %10s %10s\n",
+            "Register", "Addr", "Reads", "Writes", "Batched", "Errors", "Avg us", "Max us");
+    
+    for (int i = 0; i < MaxRegisters; i++) {
+        RegisterEntry const &entry = m_registers[i];
+        size_t key = epicsAtomicGetSizeT(&entry.key);
+        if (key == 0) {
+            continue;
+        }
+        epicsAtomicReadMemoryBarrier();
+        
+        size_t reads = epicsAtomicGetSizeT(&entry.reads);
+        size_t writes = epicsAtomicGetSizeT(&entry.writes);
+        size_t batched = epicsAtomicGetSizeT(&entry.batched);
+        
+        // The latencies are of the single accesses only.
+        size_t single_ops = reads + writes - std::min(reads + writes, batched);
+        double avg_us = (single_ops > 0) ? epicsAtomicGetSizeT(&entry.latency_sum_ns) / 1e3 / single_ops : 0.0;
+        
+        fprintf(out, "%-28s 0x%04lx %10lu %10lu %10lu %8lu %10.1f %10.1f\n",
+                (entry.name != NULL) ? entry.name : "?", (unsigned long)(key - 1),
+                (unsigned long)reads, (unsigned long)writes, (unsigned long)batched,
+                (unsigned long)epicsAtomicGetSizeT(&entry.errors),
+                avg_us, epicsAtomicGetSizeT(&entry.latency_max_ns) / 1e3);
+    }
+    
+    size_t untracked_ops = epicsAtomicGetSizeT(&m_untracked_ops);
+    if (untracked_ops > 0) {
+        fprintf(out, "Accesses of untracked registers: %lu\n", (unsigned long)untracked_ops);
+    }
+    
+    for (int i = 0; i < MaxErrorCodes; i++) {
+        size_t count = epicsAtomicGetSizeT(&m_error_codes[i]);
+        if (count > 0) {
+            fprintf(out, "Error %d (%s): %lu\n", -i,
+                    error_codes.getErrorText((CAEN_DGTZ_ErrorCode)-i), (unsigned long)count);
+        }
+    }
+    
+    fprintf(out, "Latency histogram:\n");
+    for (int i = 0; i < NumLatencyBuckets; i++) {
+        if (snapshot.latency_hist[i] > 0) {
+            fprintf(out, "  >= %10.3f us: %lu\n",
+                    (double)((uint64_t)1 << i) / 1e3, (unsigned long)snapshot.latency_hist[i]);
+        }
+    }
+}
+
+void TR_CAEN_RegisterStats::reset ()
+{
+    // The register entries are kept, only their counters are cleared.
+    for (int i = 0; i < MaxRegisters; i++) {
+        RegisterEntry &entry = m_registers[i];
+        epicsAtomicSetSizeT(&entry.reads, 0);
+        epicsAtomicSetSizeT(&entry.writes, 0);
+        epicsAtomicSetSizeT(&entry.errors, 0);
+        epicsAtomicSetSizeT(&entry.batched, 0);
+        epicsAtomicSetSizeT(&entry.latency_sum_ns, 0);
+        epicsAtomicSetSizeT(&entry.latency_max_ns, 0);
+    }
+    
+    epicsAtomicSetSizeT(&m_untracked_ops, 0);
+    epicsAtomicSetSizeT(&m_ops, 0);
+    epicsAtomicSetSizeT(&m_errors, 0);
+    for (int i = 0; i < MaxErrorCodes; i++) {
+        epicsAtomicSetSizeT(&m_error_codes[i], 0);
+    }
+    for (int i = 0; i < NumLatencyBuckets; i++) {
+        epicsAtomicSetSizeT(&m_latency_hist[i], 0);
+    }
+}
+
+TR_CAEN_RegisterStats::RegisterEntry * TR_CAEN_RegisterStats::getEntry (char const *reg_name, uint32_t reg_addr)
+{
+    size_t key = (size_t)reg_addr + 1;
+    
+    // Register addresses are multiples of 4, with the channel in bits 8-11.
+    int start = (int)((reg_addr >> 2) ^ (reg_addr >> 8)) & (MaxRegisters - 1);
+    
+    for (int i = 0; i < MaxRegisters; i++) {
+        RegisterEntry *entry = &m_registers[(start + i) & (MaxRegisters - 1)];
+        
+        size_t entry_key = epicsAtomicGetSizeT(&entry->key);
+        if (entry_key == key) {
+            return entry;
+        }
+        
+        if (entry_key == 0) {
+            // Try to claim the free entry, another thread may be faster.
+            entry_key = epicsAtomicCmpAndSwapSizeT(&entry->key, 0, key);
+            if (entry_key == 0) {
+                entry->name = reg_name;
+                epicsAtomicWriteMemoryBarrier();
+                return entry;
+            }
+            if (entry_key == key) {
+                return entry;
+            }
+        }
+    }
+    
+    return NULL;
+}
+
+int TR_CAEN_RegisterStats::getLatencyBucket (uint64_t latency_ns)
+{
+    int bucket = 0;
+    while (latency_ns > 1 && bucket < NumLatencyBuckets - 1) {
+        latency_ns >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
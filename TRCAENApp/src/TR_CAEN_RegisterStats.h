@@ -0,0 +1,116 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+#ifndef TR_CAEN_REGISTER_STATS_H
+#define TR_CAEN_REGISTER_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <CAENDigitizerType.h>
+
+#include "TR_CAEN_ErrorCodes.h"
+
+// Statistics of register accesses: call counts and latencies per register,
+// error counts by error code, and a latency histogram of all transactions,
+// i.e. single accesses and batches of accesses.
+// Accesses may be recorded from any thread concurrently with reading the
+// statistics; all counters are updated atomically without locking.
+class TR_CAEN_RegisterStats {
+public:
+    // Number of latency histogram buckets. Bucket i counts transactions which
+    // took from 2^i to 2^(i+1) nanoseconds (the last one also longer ones).
+    static int const NumLatencyBuckets = 32;
+    
+    // Totals over all registers, used to compute rates over an interval.
+    struct Snapshot {
+        size_t ops;
+        size_t errors;
+        size_t latency_hist[NumLatencyBuckets];
+    };
+    
+    TR_CAEN_RegisterStats ();
+    
+    // Returns the current time for measuring the latency (nanoseconds).
+    static uint64_t now ();
+    
+    // Records a single register access which took latency_ns (measured
+    // with now).
+    void record (char const *reg_name, uint32_t reg_addr, bool write,
+                 uint64_t latency_ns, CAEN_DGTZ_ErrorCode err);
+    
+    // Records a register access done in a batch. It has no latency of its
+    // own, the batch is recorded with recordBatch.
+    void recordBatched (char const *reg_name, uint32_t reg_addr, bool write,
+                        CAEN_DGTZ_ErrorCode err);
+    
+    // Records a batch of register accesses which took latency_ns, as one
+    // transaction in the latency histogram.
+    void recordBatch (uint64_t latency_ns);
+    
+    // Gets the current totals.
+    void getSnapshot (Snapshot *out) const;
+    
+    // Returns the latency (nanoseconds) below which the given fraction of
+    // the transactions between two snapshots were completed, estimated from
+    // the histogram, or 0 if there were no accesses.
+    static double getLatencyPercentile (Snapshot const &prev, Snapshot const &cur, double fraction);
+    
+    // Prints a report of all statistics.
+    void report (FILE *out, TR_CAEN_ErrorCodes &error_codes) const;
+    
+    // Clears all statistics. Accesses recorded concurrently may be partly lost.
+    void reset ();
+
+private:
+    // Maximum number of distinct registers tracked (power of two).
+    static int const MaxRegisters = 64;
+    
+    // Error codes are tracked for -(MaxErrorCodes-1) to 0, others are
+    // counted as the most negative.
+    static int const MaxErrorCodes = 128;
+    
+    struct RegisterEntry {
+        // Register address plus one, 0 if the entry is free.
+        size_t key;
+        char const *name;
+        size_t reads;
+        size_t writes;
+        size_t errors;
+        
+        // Accesses done in batches, which are not in the latencies.
+        size_t batched;
+        
+        size_t latency_sum_ns;
+        size_t latency_max_ns;
+    };
+    
+    RegisterEntry * getEntry (char const *reg_name, uint32_t reg_addr);
+    
+    // Counts an access in the totals and the entry of the register, which is
+    // returned (NULL if it is not tracked).
+    RegisterEntry * countAccess (char const *reg_name, uint32_t reg_addr, bool write, CAEN_DGTZ_ErrorCode err);
+    
+    static int getLatencyBucket (uint64_t latency_ns);
+    
+    // Table of registers using open addressing by the address.
+    RegisterEntry m_registers[MaxRegisters];
+    
+    // Accesses of registers which did not fit into the table.
+    size_t m_untracked_ops;
+    
+    // Totals over all registers.
+    size_t m_ops;
+    size_t m_errors;
+    size_t m_error_codes[MaxErrorCodes];
+    size_t m_latency_hist[NumLatencyBuckets];
+};
+
+#endif
@@ -11,6 +11,10 @@
 
 TR_CAEN_Register const TR_CAEN_Registers::AcqControl = {"AcqControl", 0x8100u};
 
+TR_CAEN_Register const TR_CAEN_Registers::AcqStatus = {"AcqStatus", 0x8104u};
+
+TR_CAEN_Register const TR_CAEN_Registers::EventStored = {"EventStored", 0x812Cu};
+
 TR_CAEN_Register const TR_CAEN_Registers::RunStartStopDelay = {"RunStartStopDelay", 0x8170u};
 
 TR_CAEN_Register const TR_CAEN_Registers::BoardInfo = {"BoardInfo", 0x8140u};
@@ -39,4 +43,37 @@ TR_CAEN_Register const TR_CAEN_Registers::ChannelPulseWidth[8] = {
     {"Channel7PulseWidth", 0x1770u},
 };
 
+TR_CAEN_Register const TR_CAEN_Registers::ChannelZleThreshold[8] = {
+    {"Channel0ZleThreshold", 0x1024u},
+    {"Channel1ZleThreshold", 0x1124u},
+    {"Channel2ZleThreshold", 0x1224u},
+    {"Channel3ZleThreshold", 0x1324u},
+    {"Channel4ZleThreshold", 0x1424u},
+    {"Channel5ZleThreshold", 0x1524u},
+    {"Channel6ZleThreshold", 0x1624u},
+    {"Channel7ZleThreshold", 0x1724u}
+};
+
+TR_CAEN_Register const TR_CAEN_Registers::ChannelTemperature[8] = {
+    {"Channel0Temperature", 0x10A8u},
+    {"Channel1Temperature", 0x11A8u},
+    {"Channel2Temperature", 0x12A8u},
+    {"Channel3Temperature", 0x13A8u},
+    {"Channel4Temperature", 0x14A8u},
+    {"Channel5Temperature", 0x15A8u},
+    {"Channel6Temperature", 0x16A8u},
+    {"Channel7Temperature", 0x17A8u}
+};
+
+// Writing these sets the register of all channels.
+TR_CAEN_Register const TR_CAEN_Registers::ChannelGainBroadcast = {"ChannelGainBroadcast", 0x8028u};
+
+TR_CAEN_Register const TR_CAEN_Registers::ChannelPulseWidthBroadcast = {"ChannelPulseWidthBroadcast", 0x8070u};
+
 TR_CAEN_Register const TR_CAEN_Registers::TriggerSourceEnableMask = {"TriggerSourceEnableMask", 0x810Cu};
+
+TR_CAEN_Register const TR_CAEN_Registers::ChannelEnableMask = {"ChannelEnableMask", 0x8120u};
+
+TR_CAEN_Register const TR_CAEN_Registers::DecimationFactor = {"DecimationFactor", 0x8044u};
+
+TR_CAEN_Register const TR_CAEN_Registers::PostTrigger = {"PostTrigger", 0x8114u};
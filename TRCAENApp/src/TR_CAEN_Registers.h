@@ -20,12 +20,21 @@ struct TR_CAEN_Register {
 class TR_CAEN_Registers {
 public:
     static TR_CAEN_Register const AcqControl;
+    static TR_CAEN_Register const AcqStatus;
+    static TR_CAEN_Register const EventStored;
     static TR_CAEN_Register const RunStartStopDelay;
     static TR_CAEN_Register const BoardInfo;
     static TR_CAEN_Register const FanSpeedControl;
     static TR_CAEN_Register const ChannelGain[8];
     static TR_CAEN_Register const ChannelPulseWidth[8];
+    static TR_CAEN_Register const ChannelZleThreshold[8];
+    static TR_CAEN_Register const ChannelTemperature[8];
+    static TR_CAEN_Register const ChannelGainBroadcast;
+    static TR_CAEN_Register const ChannelPulseWidthBroadcast;
     static TR_CAEN_Register const TriggerSourceEnableMask;
+    static TR_CAEN_Register const ChannelEnableMask;
+    static TR_CAEN_Register const DecimationFactor;
+    static TR_CAEN_Register const PostTrigger;
 };
 
 #endif
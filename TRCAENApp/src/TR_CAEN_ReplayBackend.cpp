@@ -0,0 +1,434 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <algorithm>
+
+#include <epicsGuard.h>
+#include <epicsThread.h>
+
+#include "TR_CAEN_ReplayBackend.h"
+#include "TR_CAEN_Registers.h"
+#include "TR_CAEN_BitUtils.h"
+#include "TR_CAEN_Decoder.h"
+
+static char const ReplayAddrPrefix[] = "replay:";
+
+bool TR_CAEN_IsReplayAddrStr (std::string const &addr_str)
+{
+    return addr_str.compare(0, sizeof(ReplayAddrPrefix) - 1, ReplayAddrPrefix) == 0;
+}
+
+static bool parse_replay_option (std::string const &key, std::string const &value, TR_CAEN_ReplayConfig *config)
+{
+    char *end;
+    
+    if (key == "speed") {
+        config->speed = ::strtod(value.c_str(), &end);
+        return !value.empty() && *end == '\0' && config->speed >= 0.0;
+    }
+    if (key == "loop") {
+        if (value != "0" && value != "1") {
+            return false;
+        }
+        config->loop = value == "1";
+        return true;
+    }
+    return false;
+}
+
+bool TR_CAEN_ParseReplayAddrStr (std::string const &addr_str, TR_CAEN_ReplayConfig *config)
+{
+    if (!TR_CAEN_IsReplayAddrStr(addr_str)) {
+        return false;
+    }
+    
+    *config = TR_CAEN_ReplayConfig();
+    
+    size_t pos = sizeof(ReplayAddrPrefix) - 1;
+    
+    // Options are present if the part before the next ':' contains '='.
+    size_t options_end = addr_str.find(':', pos);
+    if (options_end != std::string::npos && addr_str.substr(pos, options_end - pos).find('=') != std::string::npos) {
+        while (pos < options_end) {
+            size_t item_end = std::min(addr_str.find(',', pos), options_end);
+            std::string item_str = addr_str.substr(pos, item_end - pos);
+            
+            size_t eq_pos = item_str.find('=');
+            if (eq_pos == std::string::npos ||
+                !parse_replay_option(item_str.substr(0, eq_pos), item_str.substr(eq_pos + 1), config))
+            {
+                return false;
+            }
+            
+            pos = item_end + 1;
+        }
+        pos = options_end + 1;
+    }
+    
+    config->file_path = addr_str.substr(pos);
+    
+    return !config->file_path.empty();
+}
+
+TR_CAEN_ReplayBackend::TR_CAEN_ReplayBackend (TR_CAEN_ReplayConfig const &config)
+:
+    m_config(config)
+{
+    resetState();
+}
+
+std::string TR_CAEN_ReplayBackend::getDescription ()
+{
+    return std::string("replay file=") + m_config.file_path;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_ReplayBackend::open ()
+{
+    epicsGuard<epicsMutex> lock(m_mutex);
+    
+    if (m_reader.isOpen()) {
+        return CAEN_DGTZ_DigitizerAlreadyOpen;
+    }
+    
+    if (!m_reader.open(m_config.file_path)) {
+        return CAEN_DGTZ_DigitizerNotFound;
+    }
+    
+    resetState();
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_ReplayBackend::close ()
+{
+    epicsGuard<epicsMutex> lock(m_mutex);
+    
+    setRunning(false);
+    m_reader.close();
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_ReplayBackend::getInfo (CAEN_DGTZ_BoardInfo_t *info)
+{
+    epicsGuard<epicsMutex> lock(m_mutex);
+    
+    ::memset(info, 0, sizeof(*info));
+    
+    std::string model_name = m_reader.getHeaderValue("model_name", "V1730");
+    std::string roc_fw_rev = m_reader.getHeaderValue("roc_fw_rev", "");
+    std::string amc_fw_rev = m_reader.getHeaderValue("amc_fw_rev", "");
+    ::snprintf(info->ModelName, sizeof(info->ModelName), "%s", model_name.c_str());
+    ::snprintf(info->ROC_FirmwareRel, sizeof(info->ROC_FirmwareRel), "%s", roc_fw_rev.c_str());
+    ::snprintf(info->AMC_FirmwareRel, sizeof(info->AMC_FirmwareRel), "%s", amc_fw_rev.c_str());
+    
+    info->Channels = m_reader.getHeaderInt("num_channels", TR_CAEN_SimRegisterFile::NumChannels);
+    info->FamilyCode = m_reader.getHeaderInt("family", TR_CAEN_SimRegisterFile::FamilyCode);
+    info->SerialNumber = m_reader.getHeaderInt("serial_number", 0);
+    info->PCB_Revision = m_reader.getHeaderInt("pcb_revision", 0);
+    info->ADC_NBits = 14;
+    info->CommHandle = -1;
+    info->VMEHandle = -1;
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_ReplayBackend::reset ()
+{
+    epicsGuard<epicsMutex> lock(m_mutex);
+    
+    resetState();
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_ReplayBackend::calibrate ()
+{
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_ReplayBackend::readRegister (uint32_t address, uint32_t *value)
+{
+    epicsGuard<epicsMutex> lock(m_mutex);
+    
+    if (!m_reader.isOpen()) {
+        return CAEN_DGTZ_InvalidHandle;
+    }
+    
+    // Only the next record is known to be available, report its events.
+    int events_available = 0;
+    if (m_running && m_have_record && timeUntilNextRecord() <= 0.0) {
+        events_available = TR_CAEN_CountEvents((uint32_t const *)m_record_data,
+                                               m_record_header.size_bytes / sizeof(uint32_t));
+    }
+    
+    if (address == TR_CAEN_Registers::AcqStatus.reg_addr) {
+        *value = TR_CAEN_SimRegisterFile::makeAcqStatus(m_running, events_available > 0, false);
+    }
+    else if (address == TR_CAEN_Registers::EventStored.reg_addr) {
+        *value = events_available;
+    }
+    else {
+        *value = m_registers.get(address);
+    }
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_ReplayBackend::writeRegister (uint32_t address, uint32_t value)
+{
+    epicsGuard<epicsMutex> lock(m_mutex);
+    
+    if (!m_reader.isOpen()) {
+        return CAEN_DGTZ_InvalidHandle;
+    }
+    
+    m_registers.write(address, value);
+    
+    if (address == TR_CAEN_Registers::AcqControl.reg_addr) {
+        setRunning(TR_CAEN_GetBit(m_registers.get(address), 2));
+    }
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_ReplayBackend::setAcquisitionMode (CAEN_DGTZ_AcqMode_t mode)
+{
+    epicsGuard<epicsMutex> lock(m_mutex);
+    
+    m_registers.setBits(TR_CAEN_Registers::AcqControl.reg_addr, 0, 2, mode);
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_ReplayBackend::setRecordLength (uint32_t record_length)
+{
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_ReplayBackend::setZeroSuppressionMode (CAEN_DGTZ_ZS_Mode_t mode)
+{
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_ReplayBackend::setChannelZSParams (uint32_t channel, CAEN_DGTZ_ThresholdWeight_t weight,
+                                                               int32_t threshold, int32_t nsamp)
+{
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_ReplayBackend::setMaxNumEventsBLT (uint32_t num_events)
+{
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_ReplayBackend::setInterruptConfig (CAEN_DGTZ_EnaDis_t state, uint8_t level, uint32_t status_id,
+                                                               uint16_t event_number, CAEN_DGTZ_IRQMode_t mode)
+{
+    epicsGuard<epicsMutex> lock(m_mutex);
+    
+    // The interrupt is raised when the next record is available, regardless
+    // of the event number.
+    m_irq_enabled = state == CAEN_DGTZ_ENABLE && level > 0;
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_ReplayBackend::swStartAcquisition ()
+{
+    epicsGuard<epicsMutex> lock(m_mutex);
+    
+    m_registers.setBits(TR_CAEN_Registers::AcqControl.reg_addr, 2, 1, true);
+    setRunning(true);
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_ReplayBackend::swStopAcquisition ()
+{
+    epicsGuard<epicsMutex> lock(m_mutex);
+    
+    m_registers.setBits(TR_CAEN_Registers::AcqControl.reg_addr, 2, 1, false);
+    setRunning(false);
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_ReplayBackend::mallocReadoutBuffer (char **buffer, uint32_t *size)
+{
+    epicsGuard<epicsMutex> lock(m_mutex);
+    
+    if (!m_reader.isOpen()) {
+        return CAEN_DGTZ_InvalidHandle;
+    }
+    
+    // Any record must fit.
+    size_t buffer_size = m_reader.getMaxRecordSize();
+    
+    char *ptr = (char *)::malloc(buffer_size);
+    if (ptr == NULL) {
+        return CAEN_DGTZ_OutOfMemory;
+    }
+    
+    *buffer = ptr;
+    *size = buffer_size;
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_ReplayBackend::freeReadoutBuffer (char **buffer)
+{
+    ::free(*buffer);
+    *buffer = NULL;
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_ReplayBackend::readData (char *buffer, uint32_t *size)
+{
+    epicsGuard<epicsMutex> lock(m_mutex);
+    
+    if (!m_reader.isOpen()) {
+        return CAEN_DGTZ_InvalidHandle;
+    }
+    
+    *size = 0;
+    
+    if (!m_running || !m_have_record || timeUntilNextRecord() > 0.0) {
+        return CAEN_DGTZ_Success;
+    }
+    
+    ::memcpy(buffer, m_record_data, m_record_header.size_bytes);
+    *size = m_record_header.size_bytes;
+    
+    if (!fetchNextRecord() && m_reader.hadError()) {
+        return CAEN_DGTZ_CommError;
+    }
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_ReplayBackend::irqWait (uint32_t timeout_ms)
+{
+    double remaining = timeout_ms / 1000.0;
+    
+    while (true) {
+        double wait_time = remaining;
+        
+        {
+            epicsGuard<epicsMutex> lock(m_mutex);
+            
+            if (!m_reader.isOpen()) {
+                return CAEN_DGTZ_InvalidHandle;
+            }
+            
+            if (m_irq_enabled && m_running && m_have_record) {
+                double time_until = timeUntilNextRecord();
+                if (time_until <= 0.0) {
+                    return CAEN_DGTZ_Success;
+                }
+                wait_time = std::min(remaining, time_until);
+            }
+        }
+        
+        if (remaining <= 0.0) {
+            return CAEN_DGTZ_Timeout;
+        }
+        
+        epicsThreadSleep(wait_time);
+        remaining -= std::max(wait_time, 0.0001);
+    }
+}
+
+bool TR_CAEN_ReplayBackend::timeTagsFollowHostTime ()
+{
+    // The recorded time tags are replayed at any speed and possibly looped.
+    return false;
+}
+
+double TR_CAEN_ReplayBackend::recordTime (TR_CAEN_RawRecordHeader const &header)
+{
+    return header.host_sec + header.host_nsec / 1e9;
+}
+
+void TR_CAEN_ReplayBackend::resetState ()
+{
+    // The memory size is recorded in samples.
+    int mem_size_code = std::max(1, m_reader.getHeaderInt("ch_mem_size", 640000) / 640000);
+    m_registers.reset(mem_size_code);
+    
+    m_irq_enabled = false;
+    m_running = false;
+    m_have_record = false;
+    m_base_record_time = 0.0;
+    m_pass_had_records = false;
+}
+
+void TR_CAEN_ReplayBackend::setRunning (bool running)
+{
+    if (running == m_running) {
+        return;
+    }
+    
+    m_running = running;
+    m_have_record = false;
+    
+    if (running) {
+        // Start from the beginning of the file.
+        m_reader.rewind();
+        m_pass_had_records = false;
+        epicsTimeGetCurrent(&m_base_time);
+        fetchNextRecord();
+    }
+}
+
+bool TR_CAEN_ReplayBackend::fetchNextRecord ()
+{
+    m_have_record = m_reader.nextRecord(&m_record_header, &m_record_data);
+    
+    if (!m_have_record && !m_reader.hadError() && m_config.loop && m_pass_had_records) {
+        // Start over, continuing the timing from now.
+        m_reader.rewind();
+        m_pass_had_records = false;
+        epicsTimeGetCurrent(&m_base_time);
+        m_have_record = m_reader.nextRecord(&m_record_header, &m_record_data);
+    }
+    
+    if (!m_have_record) {
+        return false;
+    }
+    
+    // The first record of a pass is the reference for pacing.
+    if (!m_pass_had_records) {
+        m_base_record_time = recordTime(m_record_header);
+        m_pass_had_records = true;
+    }
+    
+    return true;
+}
+
+double TR_CAEN_ReplayBackend::timeUntilNextRecord ()
+{
+    if (m_config.speed <= 0.0) {
+        return 0.0;
+    }
+    
+    epicsTimeStamp now;
+    epicsTimeGetCurrent(&now);
+    double elapsed = epicsTimeDiffInSeconds(&now, &m_base_time);
+    
+    return (recordTime(m_record_header) - m_base_record_time) / m_config.speed - elapsed;
+}
@@ -0,0 +1,123 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+#ifndef TR_CAEN_REPLAY_BACKEND_H
+#define TR_CAEN_REPLAY_BACKEND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include <epicsMutex.h>
+#include <epicsTime.h>
+
+#include "TR_CAEN_Backend.h"
+#include "TR_CAEN_RawReader.h"
+#include "TR_CAEN_SimBackend.h"
+
+// Configuration of a replayed digitizer, from the device address string.
+struct TR_CAEN_ReplayConfig {
+    TR_CAEN_ReplayConfig ()
+    : speed(1.0),
+      loop(false)
+    {}
+    
+    // File written by TR_CAEN_RawRecorder.
+    std::string file_path;
+    
+    // Replay speed relative to the original timing, 0 for as fast as possible.
+    double speed;
+    
+    // Whether to start over at the end of the file.
+    bool loop;
+};
+
+// Returns whether the address string selects a replayed digitizer ("replay" prefix).
+bool TR_CAEN_IsReplayAddrStr (std::string const &addr_str);
+
+// Parses an address string of a replayed digitizer, "replay:<file>" or
+// "replay:<options>:<file>" where options are comma-separated, for example
+// "replay:speed=0,loop=1:/data/run1.craw". Options: speed, loop.
+bool TR_CAEN_ParseReplayAddrStr (std::string const &addr_str, TR_CAEN_ReplayConfig *config);
+
+// Backend which replays raw readout data recorded with RECORD_RAW.
+//
+// Each ReadData returns the data of one recorded ReadData. When the
+// acquisition is started, the replay starts from the beginning of the file,
+// and records become available at the recorded host times (scaled by the
+// speed) or immediately if the speed is 0. The registers are emulated like
+// in TR_CAEN_SimBackend, and the digitizer information is taken from the
+// file header. The recorded data is returned regardless of the settings,
+// only the channel enable mask affects which channels are published.
+class TR_CAEN_ReplayBackend : public TR_CAEN_Backend {
+public:
+    TR_CAEN_ReplayBackend (TR_CAEN_ReplayConfig const &config);
+    
+    std::string getDescription (); // override
+    
+    CAEN_DGTZ_ErrorCode open (); // override
+    CAEN_DGTZ_ErrorCode close (); // override
+    CAEN_DGTZ_ErrorCode getInfo (CAEN_DGTZ_BoardInfo_t *info); // override
+    CAEN_DGTZ_ErrorCode reset (); // override
+    CAEN_DGTZ_ErrorCode calibrate (); // override
+    CAEN_DGTZ_ErrorCode readRegister (uint32_t address, uint32_t *value); // override
+    CAEN_DGTZ_ErrorCode writeRegister (uint32_t address, uint32_t value); // override
+    CAEN_DGTZ_ErrorCode setAcquisitionMode (CAEN_DGTZ_AcqMode_t mode); // override
+    CAEN_DGTZ_ErrorCode setRecordLength (uint32_t record_length); // override
+    CAEN_DGTZ_ErrorCode setZeroSuppressionMode (CAEN_DGTZ_ZS_Mode_t mode); // override
+    CAEN_DGTZ_ErrorCode setChannelZSParams (uint32_t channel, CAEN_DGTZ_ThresholdWeight_t weight,
+                                            int32_t threshold, int32_t nsamp); // override
+    CAEN_DGTZ_ErrorCode setMaxNumEventsBLT (uint32_t num_events); // override
+    CAEN_DGTZ_ErrorCode setInterruptConfig (CAEN_DGTZ_EnaDis_t state, uint8_t level, uint32_t status_id,
+                                            uint16_t event_number, CAEN_DGTZ_IRQMode_t mode); // override
+    CAEN_DGTZ_ErrorCode swStartAcquisition (); // override
+    CAEN_DGTZ_ErrorCode swStopAcquisition (); // override
+    CAEN_DGTZ_ErrorCode mallocReadoutBuffer (char **buffer, uint32_t *size); // override
+    CAEN_DGTZ_ErrorCode freeReadoutBuffer (char **buffer); // override
+    CAEN_DGTZ_ErrorCode readData (char *buffer, uint32_t *size); // override
+    CAEN_DGTZ_ErrorCode irqWait (uint32_t timeout_ms); // override
+    bool timeTagsFollowHostTime (); // override
+
+private:
+    static double recordTime (TR_CAEN_RawRecordHeader const &header);
+    
+    void resetState ();
+    void setRunning (bool running);
+    bool fetchNextRecord ();
+    double timeUntilNextRecord ();
+    
+    TR_CAEN_ReplayConfig m_config;
+    
+    // Protects all of the state below.
+    epicsMutex m_mutex;
+    
+    // Reader of the file (open while the device is open).
+    TR_CAEN_RawReader m_reader;
+    
+    // Register file.
+    TR_CAEN_SimRegisterFile m_registers;
+    
+    bool m_irq_enabled;
+    bool m_running;
+    
+    // The next record to be returned, if m_have_record.
+    bool m_have_record;
+    TR_CAEN_RawRecordHeader m_record_header;
+    char const *m_record_data;
+    
+    // Host time and recorded time corresponding to each other, for pacing.
+    epicsTimeStamp m_base_time;
+    double m_base_record_time;
+    
+    // Whether any record was returned since the file was (re)started.
+    bool m_pass_had_records;
+};
+
+#endif
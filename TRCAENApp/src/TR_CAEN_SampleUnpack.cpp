@@ -0,0 +1,219 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "TR_CAEN_SampleUnpack.h"
+
+// The SIMD kernels are built for x86 with GCC-compatible compilers; the
+// AVX2 kernel is compiled with a function target attribute and only used
+// when the CPU supports it, so no special compiler flags are needed.
+#if defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define TR_CAEN_HAVE_X86_SIMD 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+// Mask of the sample bits in each 16-bit half of a data word.
+static uint16_t const SampleMask = 0x3FFF;
+
+/*
+ * Scalar reference implementation.
+ */
+
+static void unpack_scalar (uint32_t const *src, int16_t *dst, size_t num_samples)
+{
+    for (size_t i = 0; i < num_samples / 2; i++) {
+        uint32_t word = src[i];
+        dst[2 * i + 0] = word & SampleMask;
+        dst[2 * i + 1] = (word >> 16) & SampleMask;
+    }
+}
+
+static void unpack_scaled_scalar (uint32_t const *src, float *dst, size_t num_samples, float scale, float offset)
+{
+    for (size_t i = 0; i < num_samples / 2; i++) {
+        uint32_t word = src[i];
+        float s0 = (float)(int32_t)(word & SampleMask);
+        float s1 = (float)(int32_t)((word >> 16) & SampleMask);
+        float p0 = s0 * scale;
+        float p1 = s1 * scale;
+        dst[2 * i + 0] = p0 + offset;
+        dst[2 * i + 1] = p1 + offset;
+    }
+}
+
+#ifdef TR_CAEN_HAVE_X86_SIMD
+
+/*
+ * SSE2 implementation (baseline on x86-64).
+ * The two samples of a word are the low and high 16-bit halves, so in
+ * memory the words already are the samples in order as 16-bit lanes and
+ * unpacking is just masking off the top two bits of each lane.
+ */
+
+static void unpack_sse2 (uint32_t const *src, int16_t *dst, size_t num_samples)
+{
+    __m128i const mask = _mm_set1_epi16(SampleMask);
+    
+    size_t num_words = num_samples / 2;
+    size_t i = 0;
+    
+    for (; i + 4 <= num_words; i += 4) {
+        __m128i words = _mm_loadu_si128((__m128i const *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + 2 * i), _mm_and_si128(words, mask));
+    }
+    
+    unpack_scalar(src + i, dst + 2 * i, 2 * (num_words - i));
+}
+
+static void unpack_scaled_sse2 (uint32_t const *src, float *dst, size_t num_samples, float scale, float offset)
+{
+    __m128i const mask = _mm_set1_epi16(SampleMask);
+    __m128i const zero = _mm_setzero_si128();
+    __m128 const scale_v = _mm_set1_ps(scale);
+    __m128 const offset_v = _mm_set1_ps(offset);
+    
+    size_t num_words = num_samples / 2;
+    size_t i = 0;
+    
+    for (; i + 4 <= num_words; i += 4) {
+        __m128i samples = _mm_and_si128(_mm_loadu_si128((__m128i const *)(src + i)), mask);
+        __m128i lo = _mm_unpacklo_epi16(samples, zero);
+        __m128i hi = _mm_unpackhi_epi16(samples, zero);
+        __m128 lo_f = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(lo), scale_v), offset_v);
+        __m128 hi_f = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(hi), scale_v), offset_v);
+        _mm_storeu_ps(dst + 2 * i + 0, lo_f);
+        _mm_storeu_ps(dst + 2 * i + 4, hi_f);
+    }
+    
+    unpack_scaled_scalar(src + i, dst + 2 * i, 2 * (num_words - i), scale, offset);
+}
+
+/*
+ * AVX2 implementation, selected at runtime.
+ * The tails are handled here rather than by calling the SSE2 or scalar
+ * kernels, so that all code runs VEX-encoded. Calling legacy SSE code with
+ * the upper halves of the YMM registers dirty causes transition stalls.
+ */
+
+__attribute__((target("avx2")))
+static void unpack_avx2 (uint32_t const *src, int16_t *dst, size_t num_samples)
+{
+    __m256i const mask = _mm256_set1_epi16(SampleMask);
+    
+    size_t num_words = num_samples / 2;
+    size_t i = 0;
+    
+    for (; i + 16 <= num_words; i += 16) {
+        __m256i words0 = _mm256_loadu_si256((__m256i const *)(src + i + 0));
+        __m256i words1 = _mm256_loadu_si256((__m256i const *)(src + i + 8));
+        _mm256_storeu_si256((__m256i *)(dst + 2 * i + 0),  _mm256_and_si256(words0, mask));
+        _mm256_storeu_si256((__m256i *)(dst + 2 * i + 16), _mm256_and_si256(words1, mask));
+    }
+    
+    for (; i + 4 <= num_words; i += 4) {
+        __m128i words = _mm_loadu_si128((__m128i const *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + 2 * i), _mm_and_si128(words, _mm256_castsi256_si128(mask)));
+    }
+    
+    for (; i < num_words; i++) {
+        uint32_t word = src[i];
+        dst[2 * i + 0] = word & SampleMask;
+        dst[2 * i + 1] = (word >> 16) & SampleMask;
+    }
+    
+    _mm256_zeroupper();
+}
+
+__attribute__((target("avx2")))
+static void unpack_scaled_avx2 (uint32_t const *src, float *dst, size_t num_samples, float scale, float offset)
+{
+    __m256i const mask = _mm256_set1_epi16(SampleMask);
+    __m256 const scale_v = _mm256_set1_ps(scale);
+    __m256 const offset_v = _mm256_set1_ps(offset);
+    
+    size_t num_words = num_samples / 2;
+    size_t i = 0;
+    
+    for (; i + 8 <= num_words; i += 8) {
+        __m256i samples = _mm256_and_si256(_mm256_loadu_si256((__m256i const *)(src + i)), mask);
+        __m256 lo_f = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(samples)));
+        __m256 hi_f = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(samples, 1)));
+        _mm256_storeu_ps(dst + 2 * i + 0, _mm256_add_ps(_mm256_mul_ps(lo_f, scale_v), offset_v));
+        _mm256_storeu_ps(dst + 2 * i + 8, _mm256_add_ps(_mm256_mul_ps(hi_f, scale_v), offset_v));
+    }
+    
+    for (; i + 4 <= num_words; i += 4) {
+        __m128i samples = _mm_and_si128(_mm_loadu_si128((__m128i const *)(src + i)), _mm256_castsi256_si128(mask));
+        __m256 samples_f = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(samples));
+        _mm256_storeu_ps(dst + 2 * i, _mm256_add_ps(_mm256_mul_ps(samples_f, scale_v), offset_v));
+    }
+    
+    for (; i < num_words; i++) {
+        uint32_t word = src[i];
+        float s0 = (float)(int32_t)(word & SampleMask);
+        float s1 = (float)(int32_t)((word >> 16) & SampleMask);
+        float p0 = s0 * scale;
+        float p1 = s1 * scale;
+        dst[2 * i + 0] = p0 + offset;
+        dst[2 * i + 1] = p1 + offset;
+    }
+    
+    _mm256_zeroupper();
+}
+
+#endif
+
+static TR_CAEN_UnpackKernel const Kernels[TR_CAEN_NumUnpackImpls] = {
+    {"scalar", unpack_scalar, unpack_scaled_scalar},
+#ifdef TR_CAEN_HAVE_X86_SIMD
+    {"sse2",   unpack_sse2,   unpack_scaled_sse2},
+    {"avx2",   unpack_avx2,   unpack_scaled_avx2},
+#else
+    {"sse2",   NULL,          NULL},
+    {"avx2",   NULL,          NULL},
+#endif
+};
+
+static bool impl_supported (TR_CAEN_UnpackImpl impl)
+{
+    switch (impl) {
+        case TR_CAEN_UnpackImplScalar:
+            return true;
+#ifdef TR_CAEN_HAVE_X86_SIMD
+        case TR_CAEN_UnpackImplSse2:
+            return true;
+        case TR_CAEN_UnpackImplAvx2:
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+TR_CAEN_UnpackKernel const * TR_CAEN_GetUnpackKernel (TR_CAEN_UnpackImpl impl)
+{
+    if (impl < 0 || impl >= TR_CAEN_NumUnpackImpls || !impl_supported(impl)) {
+        return NULL;
+    }
+    return &Kernels[impl];
+}
+
+TR_CAEN_UnpackKernel const * TR_CAEN_GetBestUnpackKernel ()
+{
+    for (int impl = TR_CAEN_NumUnpackImpls - 1; impl >= 0; impl--) {
+        TR_CAEN_UnpackKernel const *kernel = TR_CAEN_GetUnpackKernel((TR_CAEN_UnpackImpl)impl);
+        if (kernel != NULL) {
+            return kernel;
+        }
+    }
+    return &Kernels[TR_CAEN_UnpackImplScalar];
+}
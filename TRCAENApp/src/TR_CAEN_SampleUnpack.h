@@ -0,0 +1,45 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+#ifndef TR_CAEN_SAMPLE_UNPACK_H
+#define TR_CAEN_SAMPLE_UNPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Implementations of the sample unpack kernels.
+enum TR_CAEN_UnpackImpl {
+    TR_CAEN_UnpackImplScalar,
+    TR_CAEN_UnpackImplSse2,
+    TR_CAEN_UnpackImplAvx2,
+    TR_CAEN_NumUnpackImpls
+};
+
+// Kernels which unpack the board data words, each holding two 14-bit
+// samples (bits 0-13 and 16-29), into per-channel sample arrays.
+// num_samples must be even. All implementations give bit-identical results.
+struct TR_CAEN_UnpackKernel {
+    // Name of the implementation, for reporting.
+    char const *name;
+    
+    // Unpacks raw samples.
+    void (*unpack) (uint32_t const *src, int16_t *dst, size_t num_samples);
+    
+    // Unpacks samples and converts them as dst = sample * scale + offset.
+    void (*unpack_scaled) (uint32_t const *src, float *dst, size_t num_samples, float scale, float offset);
+};
+
+// Returns the kernel for the given implementation, or NULL if it is
+// not available on this CPU or build.
+TR_CAEN_UnpackKernel const * TR_CAEN_GetUnpackKernel (TR_CAEN_UnpackImpl impl);
+
+// Returns the fastest kernel available on this CPU.
+TR_CAEN_UnpackKernel const * TR_CAEN_GetBestUnpackKernel ();
+
+#endif
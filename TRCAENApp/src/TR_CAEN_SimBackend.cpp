@@ -0,0 +1,624 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <cmath>
+#include <string>
+#include <algorithm>
+
+#include <epicsGuard.h>
+#include <epicsThread.h>
+
+#include "TR_CAEN_SimBackend.h"
+#include "TR_CAEN_Registers.h"
+#include "TR_CAEN_BitUtils.h"
+#include "TR_CAEN_Decoder.h"
+
+static char const SimAddrPrefix[] = "sim";
+
+// Registers at 0x8020-0x80FF write the same register of all channels,
+// which are at 0x1n20-0x1nFF.
+static uint32_t const BroadcastFirst = 0x8020u;
+static uint32_t const BroadcastLast = 0x80FFu;
+
+// Registers which set and clear bits of the board configuration at 0x8000.
+static uint32_t const BoardConfig = 0x8000u;
+static uint32_t const BoardConfigBitSet = 0x8004u;
+static uint32_t const BoardConfigBitClear = 0x8008u;
+
+bool TR_CAEN_IsSimAddrStr (std::string const &addr_str)
+{
+    return addr_str.compare(0, sizeof(SimAddrPrefix) - 1, SimAddrPrefix) == 0 &&
+           (addr_str.size() == sizeof(SimAddrPrefix) - 1 || addr_str[sizeof(SimAddrPrefix) - 1] == ':');
+}
+
+static bool parse_double (std::string const &str, double *value)
+{
+    char const *cstr = str.c_str();
+    char *end;
+    *value = ::strtod(cstr, &end);
+    return !str.empty() && *end == '\0';
+}
+
+static bool parse_int (std::string const &str, int *value)
+{
+    char const *cstr = str.c_str();
+    char *end;
+    *value = ::strtol(cstr, &end, 0);
+    return !str.empty() && *end == '\0';
+}
+
+static bool parse_sim_option (std::string const &key, std::string const &value, TR_CAEN_SimConfig *config)
+{
+    if (key == "boards") {
+        return parse_int(value, &config->num_boards) && config->num_boards >= 1;
+    }
+    if (key == "rate") {
+        return parse_double(value, &config->trigger_rate) && config->trigger_rate >= 0.0;
+    }
+    if (key == "shape") {
+        config->waveform.shape = TR_CAEN_EventGenShapeFromName(value);
+        return config->waveform.shape >= 0;
+    }
+    if (key == "baseline") {
+        return parse_double(value, &config->waveform.baseline);
+    }
+    if (key == "amplitude") {
+        return parse_double(value, &config->waveform.amplitude);
+    }
+    if (key == "period") {
+        return parse_double(value, &config->waveform.period) && config->waveform.period > 0.0;
+    }
+    if (key == "noise") {
+        return parse_double(value, &config->waveform.noise) && config->waveform.noise >= 0.0;
+    }
+    if (key == "seed") {
+        int seed;
+        if (!parse_int(value, &seed)) {
+            return false;
+        }
+        config->waveform.seed = seed;
+        return true;
+    }
+    if (key == "memsize") {
+        return parse_int(value, &config->mem_size_code) && config->mem_size_code >= 1 && config->mem_size_code <= 255;
+    }
+    if (key == "serial") {
+        return parse_int(value, &config->serial_number) && config->serial_number >= 0;
+    }
+    return false;
+}
+
+bool TR_CAEN_ParseSimAddrStr (std::string const &addr_str, TR_CAEN_SimConfig *config)
+{
+    if (!TR_CAEN_IsSimAddrStr(addr_str)) {
+        return false;
+    }
+    
+    *config = TR_CAEN_SimConfig();
+    
+    size_t item_pos = sizeof(SimAddrPrefix);
+    if (item_pos > addr_str.size()) {
+        return true;
+    }
+    
+    // Parse the comma-separated key=value options.
+    while (true) {
+        size_t item_end = addr_str.find(',', item_pos);
+        if (item_end == std::string::npos) {
+            item_end = addr_str.size();
+        }
+        std::string item_str = addr_str.substr(item_pos, item_end - item_pos);
+        
+        size_t eq_pos = item_str.find('=');
+        if (eq_pos == std::string::npos ||
+            !parse_sim_option(item_str.substr(0, eq_pos), item_str.substr(eq_pos + 1), config))
+        {
+            return false;
+        }
+        
+        if (item_end == addr_str.size()) {
+            break;
+        }
+        item_pos = item_end + 1;
+    }
+    
+    return true;
+}
+
+void TR_CAEN_SimRegisterFile::reset (int mem_size_code)
+{
+    m_registers.clear();
+    
+    // Bits 0-7: family code, bits 8-15: memory size, bits 16-23: channels.
+    set(TR_CAEN_Registers::BoardInfo.reg_addr,
+        FamilyCode | ((uint32_t)mem_size_code << 8) | ((uint32_t)NumChannels << 16));
+    set(TR_CAEN_Registers::ChannelEnableMask.reg_addr, 0xFF);
+    
+    // ADC temperatures (degrees C).
+    for (int ch = 0; ch < NumChannels; ch++) {
+        set(TR_CAEN_Registers::ChannelTemperature[ch].reg_addr, 40 + ch);
+    }
+}
+
+uint32_t TR_CAEN_SimRegisterFile::get (uint32_t address) const
+{
+    std::map<uint32_t, uint32_t>::const_iterator it = m_registers.find(address);
+    return (it != m_registers.end()) ? it->second : 0;
+}
+
+void TR_CAEN_SimRegisterFile::set (uint32_t address, uint32_t value)
+{
+    m_registers[address] = value;
+}
+
+void TR_CAEN_SimRegisterFile::setBits (uint32_t address, int bit_offset, int num_bits, uint32_t value)
+{
+    uint32_t reg_value = get(address);
+    TR_CAEN_SetBits<uint32_t>(&reg_value, bit_offset, num_bits, value);
+    set(address, reg_value);
+}
+
+void TR_CAEN_SimRegisterFile::write (uint32_t address, uint32_t value)
+{
+    if (address == BoardConfigBitSet) {
+        set(BoardConfig, get(BoardConfig) | value);
+    }
+    else if (address == BoardConfigBitClear) {
+        set(BoardConfig, get(BoardConfig) & ~value);
+    }
+    else if (address == TR_CAEN_Registers::AcqStatus.reg_addr ||
+             address == TR_CAEN_Registers::EventStored.reg_addr ||
+             address == TR_CAEN_Registers::BoardInfo.reg_addr)
+    {
+        // Read-only.
+    }
+    else {
+        set(address, value);
+        
+        if (address >= BroadcastFirst && address <= BroadcastLast) {
+            for (int ch = 0; ch < NumChannels; ch++) {
+                set(0x1000u + 0x100u * ch + (address & 0xFFu), value);
+            }
+        }
+    }
+}
+
+uint32_t TR_CAEN_SimRegisterFile::makeAcqStatus (bool running, bool event_ready, bool memory_full)
+{
+    uint32_t status = 0;
+    TR_CAEN_SetBit(&status, 2, running);      // run
+    TR_CAEN_SetBit(&status, 3, event_ready);  // event ready
+    TR_CAEN_SetBit(&status, 4, memory_full);  // event full
+    TR_CAEN_SetBit(&status, 7, true);         // PLL locked
+    TR_CAEN_SetBit(&status, 8, true);         // board ready
+    return status;
+}
+
+TR_CAEN_SimBackend::TR_CAEN_SimBackend (TR_CAEN_SimConfig const &config, int board_index)
+:
+    m_config(config),
+    m_board_index(board_index),
+    m_open(false)
+{
+    // Each board gets different noise.
+    m_config.waveform.seed += board_index;
+    m_event_gen.setConfig(m_config.waveform);
+    
+    resetState();
+}
+
+std::string TR_CAEN_SimBackend::getDescription ()
+{
+    char desc[64];
+    ::sprintf(desc, "simulated board=%d", m_board_index);
+    return desc;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_SimBackend::open ()
+{
+    epicsGuard<epicsMutex> lock(m_mutex);
+    
+    if (m_open) {
+        return CAEN_DGTZ_DigitizerAlreadyOpen;
+    }
+    
+    m_open = true;
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_SimBackend::close ()
+{
+    epicsGuard<epicsMutex> lock(m_mutex);
+    
+    setRunning(false);
+    m_open = false;
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_SimBackend::getInfo (CAEN_DGTZ_BoardInfo_t *info)
+{
+    ::memset(info, 0, sizeof(*info));
+    ::strcpy(info->ModelName, "V1730SIM");
+    info->Channels = TR_CAEN_SimRegisterFile::NumChannels;
+    info->FamilyCode = TR_CAEN_SimRegisterFile::FamilyCode;
+    ::strcpy(info->ROC_FirmwareRel, "sim");
+    ::strcpy(info->AMC_FirmwareRel, "sim");
+    info->SerialNumber = m_config.serial_number + m_board_index;
+    info->ADC_NBits = 14;
+    info->CommHandle = -1;
+    info->VMEHandle = -1;
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_SimBackend::reset ()
+{
+    epicsGuard<epicsMutex> lock(m_mutex);
+    
+    resetState();
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_SimBackend::calibrate ()
+{
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_SimBackend::readRegister (uint32_t address, uint32_t *value)
+{
+    epicsGuard<epicsMutex> lock(m_mutex);
+    
+    if (!m_open) {
+        return CAEN_DGTZ_InvalidHandle;
+    }
+    
+    updateEvents();
+    
+    if (address == TR_CAEN_Registers::AcqStatus.reg_addr) {
+        *value = TR_CAEN_SimRegisterFile::makeAcqStatus(m_running, !m_stored_events.empty(), m_memory_full);
+    }
+    else if (address == TR_CAEN_Registers::EventStored.reg_addr) {
+        *value = m_stored_events.size();
+    }
+    else {
+        *value = m_registers.get(address);
+    }
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_SimBackend::writeRegister (uint32_t address, uint32_t value)
+{
+    epicsGuard<epicsMutex> lock(m_mutex);
+    
+    if (!m_open) {
+        return CAEN_DGTZ_InvalidHandle;
+    }
+    
+    // Account for the events up to now with the old settings.
+    updateEvents();
+    
+    m_registers.write(address, value);
+    
+    if (address == TR_CAEN_Registers::AcqControl.reg_addr) {
+        setRunning(TR_CAEN_GetBit(m_registers.get(address), 2));
+    }
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_SimBackend::setAcquisitionMode (CAEN_DGTZ_AcqMode_t mode)
+{
+    epicsGuard<epicsMutex> lock(m_mutex);
+    
+    // The start/stop mode is in the lowest bits of AcqControl. All modes are
+    // simulated like the software controlled mode.
+    m_registers.setBits(TR_CAEN_Registers::AcqControl.reg_addr, 0, 2, mode);
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_SimBackend::setRecordLength (uint32_t record_length)
+{
+    epicsGuard<epicsMutex> lock(m_mutex);
+    
+    if (record_length == 0 || record_length % 2 != 0 ||
+        record_length > 640000u * m_config.mem_size_code)
+    {
+        return CAEN_DGTZ_InvalidParam;
+    }
+    
+    m_record_length = record_length;
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_SimBackend::setZeroSuppressionMode (CAEN_DGTZ_ZS_Mode_t mode)
+{
+    if (mode != CAEN_DGTZ_ZS_NO && mode != CAEN_DGTZ_ZS_ZLE) {
+        return CAEN_DGTZ_InvalidParam;
+    }
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_SimBackend::setChannelZSParams (uint32_t channel, CAEN_DGTZ_ThresholdWeight_t weight,
+                                                            int32_t threshold, int32_t nsamp)
+{
+    epicsGuard<epicsMutex> lock(m_mutex);
+    
+    if (channel >= (uint32_t)TR_CAEN_SimRegisterFile::NumChannels) {
+        return CAEN_DGTZ_InvalidChannelNumber;
+    }
+    
+    // Keep the polarity bit of the threshold register.
+    m_registers.setBits(TR_CAEN_Registers::ChannelZleThreshold[channel].reg_addr, 0, 14, threshold);
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_SimBackend::setMaxNumEventsBLT (uint32_t num_events)
+{
+    epicsGuard<epicsMutex> lock(m_mutex);
+    
+    if (num_events == 0 || num_events > (uint32_t)MaxStoredEvents) {
+        return CAEN_DGTZ_InvalidParam;
+    }
+    
+    m_max_events_blt = num_events;
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_SimBackend::setInterruptConfig (CAEN_DGTZ_EnaDis_t state, uint8_t level, uint32_t status_id,
+                                                            uint16_t event_number, CAEN_DGTZ_IRQMode_t mode)
+{
+    epicsGuard<epicsMutex> lock(m_mutex);
+    
+    m_irq_enabled = state == CAEN_DGTZ_ENABLE && level > 0;
+    m_irq_event_number = std::max((uint16_t)1, event_number);
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_SimBackend::swStartAcquisition ()
+{
+    epicsGuard<epicsMutex> lock(m_mutex);
+    
+    m_registers.setBits(TR_CAEN_Registers::AcqControl.reg_addr, 2, 1, true);
+    
+    setRunning(true);
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_SimBackend::swStopAcquisition ()
+{
+    epicsGuard<epicsMutex> lock(m_mutex);
+    
+    updateEvents();
+    
+    m_registers.setBits(TR_CAEN_Registers::AcqControl.reg_addr, 2, 1, false);
+    
+    setRunning(false);
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_SimBackend::mallocReadoutBuffer (char **buffer, uint32_t *size)
+{
+    epicsGuard<epicsMutex> lock(m_mutex);
+    
+    // Like the library, size the buffer for the current settings.
+    size_t buffer_size = m_max_events_blt * getMaxEventWords() * sizeof(uint32_t);
+    
+    char *ptr = (char *)::malloc(buffer_size);
+    if (ptr == NULL) {
+        return CAEN_DGTZ_OutOfMemory;
+    }
+    
+    *buffer = ptr;
+    *size = buffer_size;
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_SimBackend::freeReadoutBuffer (char **buffer)
+{
+    ::free(*buffer);
+    *buffer = NULL;
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_SimBackend::readData (char *buffer, uint32_t *size)
+{
+    epicsGuard<epicsMutex> lock(m_mutex);
+    
+    if (!m_open) {
+        return CAEN_DGTZ_InvalidHandle;
+    }
+    
+    updateEvents();
+    
+    // The buffer was allocated for m_max_events_blt events with the current
+    // settings (the driver does not change them while acquiring).
+    size_t num_events = std::min((size_t)m_max_events_blt, m_stored_events.size());
+    size_t event_words = m_event_gen.getEventWords();
+    uint32_t *out = (uint32_t *)buffer;
+    
+    for (size_t i = 0; i < num_events; i++) {
+        m_event_gen.generateEvent(out, m_board_index, m_event_counter, m_stored_events.front());
+        m_event_counter = (m_event_counter + 1) & 0xFFFFFF;
+        m_stored_events.pop_front();
+        out += event_words;
+    }
+    
+    // Reading makes space in the memory.
+    if (num_events > 0) {
+        m_memory_full = false;
+    }
+    
+    *size = num_events * event_words * sizeof(uint32_t);
+    
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode TR_CAEN_SimBackend::irqWait (uint32_t timeout_ms)
+{
+    double remaining = timeout_ms / 1000.0;
+    
+    while (true) {
+        double wait_time = remaining;
+        
+        {
+            epicsGuard<epicsMutex> lock(m_mutex);
+            
+            if (!m_open) {
+                return CAEN_DGTZ_InvalidHandle;
+            }
+            
+            updateEvents();
+            
+            if (m_irq_enabled && m_running) {
+                if (m_stored_events.size() >= m_irq_event_number) {
+                    return CAEN_DGTZ_Success;
+                }
+                
+                // Wait until enough events would be stored.
+                if (triggersEnabled() && !m_memory_full) {
+                    epicsTimeStamp now;
+                    epicsTimeGetCurrent(&now);
+                    double elapsed = epicsTimeDiffInSeconds(&now, &m_start_time);
+                    size_t missing = m_irq_event_number - m_stored_events.size();
+                    double ready_time = m_next_trigger_time + (missing - 1) / m_config.trigger_rate;
+                    wait_time = std::min(remaining, std::max(0.0, ready_time - elapsed));
+                }
+            }
+        }
+        
+        if (remaining <= 0.0) {
+            return CAEN_DGTZ_Timeout;
+        }
+        
+        epicsThreadSleep(wait_time);
+        remaining -= std::max(wait_time, 0.0001);
+    }
+}
+
+void TR_CAEN_SimBackend::resetState ()
+{
+    m_registers.reset(m_config.mem_size_code);
+    
+    m_record_length = 1024;
+    m_max_events_blt = 1;
+    m_irq_enabled = false;
+    m_irq_event_number = 1;
+    
+    m_running = false;
+    m_memory_full = false;
+    m_stored_events.clear();
+    m_event_counter = 0;
+}
+
+void TR_CAEN_SimBackend::setRunning (bool running)
+{
+    if (running == m_running) {
+        return;
+    }
+    
+    m_running = running;
+    
+    if (running) {
+        // The memory is cleared and the counters restart.
+        epicsTimeGetCurrent(&m_start_time);
+        m_next_trigger_time = (m_config.trigger_rate > 0.0) ? 1.0 / m_config.trigger_rate : 0.0;
+        m_memory_full = false;
+        m_stored_events.clear();
+        m_event_counter = 0;
+        
+        // Prepare the waveforms with the trigger position from the Post Trigger register.
+        uint32_t channel_mask = m_registers.get(TR_CAEN_Registers::ChannelEnableMask.reg_addr) & 0xFF;
+        size_t post_samples = 2 * (size_t)m_registers.get(TR_CAEN_Registers::PostTrigger.reg_addr);
+        size_t trigger_offset = m_record_length - std::min(post_samples, (size_t)m_record_length);
+        m_event_gen.prepare(channel_mask, m_record_length, trigger_offset);
+    }
+}
+
+void TR_CAEN_SimBackend::updateEvents ()
+{
+    if (!m_running || m_config.trigger_rate <= 0.0) {
+        return;
+    }
+    
+    epicsTimeStamp now;
+    epicsTimeGetCurrent(&now);
+    double elapsed = epicsTimeDiffInSeconds(&now, &m_start_time);
+    double period = 1.0 / m_config.trigger_rate;
+    
+    if (m_next_trigger_time > elapsed) {
+        return;
+    }
+    
+    // Triggers while no trigger source is enabled are skipped.
+    if (!triggersEnabled()) {
+        m_next_trigger_time += std::floor((elapsed - m_next_trigger_time) / period + 1.0) * period;
+        return;
+    }
+    
+    int capacity = getEventCapacity();
+    
+    while (m_next_trigger_time <= elapsed && m_stored_events.size() < (size_t)capacity) {
+        // The time tag counter has TR_CAEN_TimeTagBits bits, leave the
+        // rollover flag clear.
+        uint64_t time_tag = (uint64_t)(m_next_trigger_time * TR_CAEN_TimeTagFrequency);
+        m_stored_events.push_back((uint32_t)time_tag & (((uint32_t)1 << TR_CAEN_TimeTagBits) - 1));
+        m_next_trigger_time += period;
+    }
+    
+    // Triggers while the memory is full are lost.
+    if (m_next_trigger_time <= elapsed) {
+        m_memory_full = true;
+        m_next_trigger_time += std::floor((elapsed - m_next_trigger_time) / period + 1.0) * period;
+    }
+}
+
+bool TR_CAEN_SimBackend::triggersEnabled ()
+{
+    // External trigger (bit 30) or channel self-triggers (bits 0-7).
+    uint32_t trigger_mask = m_registers.get(TR_CAEN_Registers::TriggerSourceEnableMask.reg_addr);
+    return (trigger_mask & 0x400000FFu) != 0;
+}
+
+int TR_CAEN_SimBackend::getEventCapacity ()
+{
+    size_t mem_samples = 640000u * m_config.mem_size_code;
+    return (int)std::min((size_t)MaxStoredEvents, mem_samples / std::max((uint32_t)1, m_record_length));
+}
+
+size_t TR_CAEN_SimBackend::getMaxEventWords ()
+{
+    uint32_t channel_mask = m_registers.get(TR_CAEN_Registers::ChannelEnableMask.reg_addr) & 0xFF;
+    
+    int num_channels = 0;
+    for (int ch = 0; ch < TR_CAEN_SimRegisterFile::NumChannels; ch++) {
+        num_channels += TR_CAEN_GetBit(channel_mask, ch);
+    }
+    
+    return TR_CAEN_EventHeaderWords + num_channels * (m_record_length / 2);
+}
@@ -0,0 +1,177 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+#ifndef TR_CAEN_SIM_BACKEND_H
+#define TR_CAEN_SIM_BACKEND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <map>
+#include <deque>
+
+#include <epicsMutex.h>
+#include <epicsTime.h>
+
+#include "TR_CAEN_Backend.h"
+#include "TR_CAEN_EventGen.h"
+
+// Link number used for the link scheduler of simulated and replayed digitizers.
+static int const TR_CAEN_SimLinkNumber = -1;
+
+// Configuration of simulated digitizers, from the device address string.
+struct TR_CAEN_SimConfig {
+    TR_CAEN_SimConfig ()
+    : num_boards(1),
+      trigger_rate(100.0),
+      mem_size_code(1),
+      serial_number(1)
+    {}
+    
+    // Number of simulated digitizers.
+    int num_boards;
+    
+    // Rate of triggers while a trigger source is enabled (Hz).
+    double trigger_rate;
+    
+    // Memory size as reported in the BoardInfo register (units of 640k samples per channel).
+    int mem_size_code;
+    
+    // Serial number of the first digitizer (incremented for others).
+    int serial_number;
+    
+    // Synthetic waveforms.
+    TR_CAEN_EventGenConfig waveform;
+};
+
+// Returns whether the address string selects simulated digitizers ("sim" prefix).
+bool TR_CAEN_IsSimAddrStr (std::string const &addr_str);
+
+// Parses an address string of simulated digitizers, "sim" optionally followed
+// by ":" and comma-separated options, for example
+// "sim:rate=1000,shape=sine,amplitude=2000,period=100,noise=2,boards=4".
+// Options: boards, rate, shape (pulse, sine, ramp, flat), baseline, amplitude,
+// period, noise, seed, memsize, serial.
+bool TR_CAEN_ParseSimAddrStr (std::string const &addr_str, TR_CAEN_SimConfig *config);
+
+// Register file of a software-emulated x730 digitizer (see
+// TR_CAEN_SimBackend and TR_CAEN_ReplayBackend). Registers which were not
+// written read as zero. The backends compute the status registers.
+class TR_CAEN_SimRegisterFile {
+public:
+    // Number of channels.
+    static int const NumChannels = 8;
+    
+    // Board family code of the x730.
+    static uint32_t const FamilyCode = 11;
+    
+    // Sets the registers to the state after a reset.
+    void reset (int mem_size_code);
+    
+    uint32_t get (uint32_t address) const;
+    void set (uint32_t address, uint32_t value);
+    void setBits (uint32_t address, int bit_offset, int num_bits, uint32_t value);
+    
+    // Performs a register write from the driver, including writes to the
+    // board configuration bit set/clear registers and channel broadcast
+    // registers. Writes to read-only registers are ignored.
+    void write (uint32_t address, uint32_t value);
+    
+    // Returns the AcqStatus register value for the given state.
+    static uint32_t makeAcqStatus (bool running, bool event_ready, bool memory_full);
+
+private:
+    std::map<uint32_t, uint32_t> m_registers;
+};
+
+// Backend simulating an x730 digitizer in software.
+//
+// It models the registers used by the driver (see TR_CAEN_Registers) as a
+// register file, the acquisition state (started by SWStartAcquisition or the
+// AcqControl register) and the event memory. While running and any external
+// or channel self-trigger is enabled, triggers occur at the configured rate
+// and store events with synthetic waveforms until the memory is full.
+// Data is returned in the uncompressed format even when ZLE is enabled.
+class TR_CAEN_SimBackend : public TR_CAEN_Backend {
+public:
+    // board_index selects the board ID, serial number and random seed.
+    TR_CAEN_SimBackend (TR_CAEN_SimConfig const &config, int board_index);
+    
+    std::string getDescription (); // override
+    
+    CAEN_DGTZ_ErrorCode open (); // override
+    CAEN_DGTZ_ErrorCode close (); // override
+    CAEN_DGTZ_ErrorCode getInfo (CAEN_DGTZ_BoardInfo_t *info); // override
+    CAEN_DGTZ_ErrorCode reset (); // override
+    CAEN_DGTZ_ErrorCode calibrate (); // override
+    CAEN_DGTZ_ErrorCode readRegister (uint32_t address, uint32_t *value); // override
+    CAEN_DGTZ_ErrorCode writeRegister (uint32_t address, uint32_t value); // override
+    CAEN_DGTZ_ErrorCode setAcquisitionMode (CAEN_DGTZ_AcqMode_t mode); // override
+    CAEN_DGTZ_ErrorCode setRecordLength (uint32_t record_length); // override
+    CAEN_DGTZ_ErrorCode setZeroSuppressionMode (CAEN_DGTZ_ZS_Mode_t mode); // override
+    CAEN_DGTZ_ErrorCode setChannelZSParams (uint32_t channel, CAEN_DGTZ_ThresholdWeight_t weight,
+                                            int32_t threshold, int32_t nsamp); // override
+    CAEN_DGTZ_ErrorCode setMaxNumEventsBLT (uint32_t num_events); // override
+    CAEN_DGTZ_ErrorCode setInterruptConfig (CAEN_DGTZ_EnaDis_t state, uint8_t level, uint32_t status_id,
+                                            uint16_t event_number, CAEN_DGTZ_IRQMode_t mode); // override
+    CAEN_DGTZ_ErrorCode swStartAcquisition (); // override
+    CAEN_DGTZ_ErrorCode swStopAcquisition (); // override
+    CAEN_DGTZ_ErrorCode mallocReadoutBuffer (char **buffer, uint32_t *size); // override
+    CAEN_DGTZ_ErrorCode freeReadoutBuffer (char **buffer); // override
+    CAEN_DGTZ_ErrorCode readData (char *buffer, uint32_t *size); // override
+    CAEN_DGTZ_ErrorCode irqWait (uint32_t timeout_ms); // override
+
+private:
+    // Maximum number of events in the memory (number of memory buffers).
+    static int const MaxStoredEvents = 1024;
+    
+    void resetState ();
+    void setRunning (bool running);
+    void updateEvents ();
+    bool triggersEnabled ();
+    int getEventCapacity ();
+    size_t getMaxEventWords ();
+    
+    TR_CAEN_SimConfig m_config;
+    int m_board_index;
+    
+    // Protects all of the state below.
+    epicsMutex m_mutex;
+    
+    bool m_open;
+    
+    // Register file.
+    TR_CAEN_SimRegisterFile m_registers;
+    
+    // Settings done through library functions rather than registers.
+    uint32_t m_record_length;
+    uint32_t m_max_events_blt;
+    bool m_irq_enabled;
+    uint32_t m_irq_event_number;
+    
+    // Acquisition state.
+    bool m_running;
+    bool m_memory_full;
+    epicsTimeStamp m_start_time;
+    
+    // Time of the next trigger, in seconds since the start.
+    double m_next_trigger_time;
+    
+    // Trigger time tags of the events in the memory.
+    std::deque<uint32_t> m_stored_events;
+    
+    // Event counter of the next event.
+    uint32_t m_event_counter;
+    
+    // Generator of the event data.
+    TR_CAEN_EventGen m_event_gen;
+};
+
+#endif
@@ -0,0 +1,91 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+#ifndef TR_CAEN_SPSC_RING_H
+#define TR_CAEN_SPSC_RING_H
+
+#include <stddef.h>
+
+#include <epicsAtomic.h>
+
+// Lock-free single-producer/single-consumer ring of preallocated items.
+// The producer fills the item returned by producerItem and publishes it
+// with produce; the consumer processes the item returned by consumerItem
+// and gives it back with consume. Items are never copied.
+template <typename ItemType, size_t Capacity>
+class TR_CAEN_SpscRing {
+public:
+    TR_CAEN_SpscRing ()
+    : m_head(0), m_tail(0)
+    {}
+    
+    // Access to all items for setup, only when both sides are idle.
+    ItemType & item (size_t index)
+    {
+        return m_items[index];
+    }
+    
+    // Discard all queued items, only when both sides are idle.
+    void reset ()
+    {
+        epicsAtomicSetSizeT(&m_head, 0);
+        epicsAtomicSetSizeT(&m_tail, 0);
+    }
+    
+    // Number of queued items (approximate if called concurrently).
+    size_t size () const
+    {
+        return epicsAtomicGetSizeT(&m_head) - epicsAtomicGetSizeT(&m_tail);
+    }
+    
+    // Producer: returns the next free item, or NULL if the ring is full.
+    ItemType * producerItem ()
+    {
+        size_t head = epicsAtomicGetSizeT(&m_head);
+        if (head - epicsAtomicGetSizeT(&m_tail) == Capacity) {
+            return NULL;
+        }
+        // Do not touch the item before seeing that the consumer released it.
+        epicsAtomicReadMemoryBarrier();
+        return &m_items[head % Capacity];
+    }
+    
+    // Producer: publishes the item returned by producerItem.
+    void produce ()
+    {
+        epicsAtomicWriteMemoryBarrier();
+        epicsAtomicSetSizeT(&m_head, epicsAtomicGetSizeT(&m_head) + 1);
+    }
+    
+    // Consumer: returns the oldest queued item, or NULL if the ring is empty.
+    ItemType * consumerItem ()
+    {
+        size_t tail = epicsAtomicGetSizeT(&m_tail);
+        if (epicsAtomicGetSizeT(&m_head) == tail) {
+            return NULL;
+        }
+        // Do not read the item before seeing that the producer published it.
+        epicsAtomicReadMemoryBarrier();
+        return &m_items[tail % Capacity];
+    }
+    
+    // Consumer: releases the item returned by consumerItem.
+    void consume ()
+    {
+        epicsAtomicWriteMemoryBarrier();
+        epicsAtomicSetSizeT(&m_tail, epicsAtomicGetSizeT(&m_tail) + 1);
+    }
+    
+private:
+    ItemType m_items[Capacity];
+    size_t m_head;
+    size_t m_tail;
+};
+
+#endif
@@ -0,0 +1,154 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <string>
+#include <map>
+
+#include "TR_CAEN_ThreadPool.h"
+
+// Runs a task on the shared worker thread which pins it to the link's CPU.
+class TR_CAEN_PinTaskRunnable : public TRWorkerThreadRunnable {
+public:
+    TR_CAEN_PinTaskRunnable (int cpu)
+    : m_cpu(cpu)
+    {}
+    
+    void runWorkerThreadTask (int id) // override
+    {
+        TR_CAEN_ThreadPool::pinCurrentThread(m_cpu);
+    }
+
+private:
+    int m_cpu;
+};
+
+// Shared worker thread of a link.
+struct TR_CAEN_PoolWorker {
+    TR_CAEN_PoolWorker (std::string const &name, int stack_size, int priority, int cpu)
+    : worker(name, stack_size, priority),
+      pin_runnable(cpu)
+    {}
+    
+    TRWorkerThread worker;
+    TR_CAEN_PinTaskRunnable pin_runnable;
+    TRWorkerThreadTask pin_task;
+};
+
+// Pool state. This is only modified from iocsh before any device is
+// initialized, so no locking is needed.
+static bool pool_enabled = false;
+static bool pool_frozen = false;
+static int pool_worker_prio = 0;
+static int pool_worker_stack_size = 0;
+static std::map<int, int> pool_link_cpus;
+static std::map<int, TR_CAEN_PoolWorker *> pool_workers;
+
+static bool parseLinkCpus (char const *link_cpus, std::map<int, int> *out)
+{
+    out->clear();
+    
+    char const *pos = link_cpus;
+    while (*pos != '\0') {
+        char *end;
+        long link_number = ::strtol(pos, &end, 0);
+        if (end == pos || *end != ':' || link_number < 0) {
+            return false;
+        }
+        pos = end + 1;
+        
+        long cpu = ::strtol(pos, &end, 0);
+        if (end == pos || (*end != ',' && *end != '\0') || cpu < 0 || cpu >= CPU_SETSIZE) {
+            return false;
+        }
+        pos = (*end == ',') ? end + 1 : end;
+        
+        if (out->count(link_number) != 0) {
+            return false;
+        }
+        (*out)[link_number] = cpu;
+    }
+    
+    return true;
+}
+
+bool TR_CAEN_ThreadPool::configure (char const *link_cpus, int worker_prio_epics, int worker_stack_size)
+{
+    if (pool_frozen) {
+        fprintf(stderr, "TR_CAEN_ConfigurePool Error: must be called before TR_CAEN_InitDevice.\n");
+        return false;
+    }
+    
+    if (!parseLinkCpus((link_cpus != NULL) ? link_cpus : "", &pool_link_cpus)) {
+        fprintf(stderr, "TR_CAEN_ConfigurePool Error: bad link to CPU map.\n");
+        return false;
+    }
+    
+    pool_enabled = true;
+    pool_worker_prio = worker_prio_epics;
+    pool_worker_stack_size = worker_stack_size;
+    
+    return true;
+}
+
+TRWorkerThread * TR_CAEN_ThreadPool::getWorkerForLink (int link_number)
+{
+    pool_frozen = true;
+    
+    if (!pool_enabled) {
+        return NULL;
+    }
+    
+    std::map<int, TR_CAEN_PoolWorker *>::iterator it = pool_workers.find(link_number);
+    if (it != pool_workers.end()) {
+        return &it->second->worker;
+    }
+    
+    char name[20];
+    ::sprintf(name, "TRwork:link%d", link_number);
+    
+    TR_CAEN_PoolWorker *pool_worker = new TR_CAEN_PoolWorker(
+        name, pool_worker_stack_size, pool_worker_prio, getCpuForLink(link_number));
+    pool_workers[link_number] = pool_worker;
+    
+    pool_worker->pin_task.init(&pool_worker->worker, &pool_worker->pin_runnable, 0);
+    pool_worker->worker.start();
+    pool_worker->pin_task.start();
+    
+    return &pool_worker->worker;
+}
+
+int TR_CAEN_ThreadPool::getCpuForLink (int link_number)
+{
+    std::map<int, int>::const_iterator it = pool_link_cpus.find(link_number);
+    return (it != pool_link_cpus.end()) ? it->second : -1;
+}
+
+void TR_CAEN_ThreadPool::pinCurrentThread (int cpu)
+{
+    if (cpu < 0) {
+        return;
+    }
+    
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    
+    int res = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+    if (res != 0) {
+        fprintf(stderr, "TR_CAEN_ThreadPool Error: failed to pin thread to CPU %d: %s.\n",
+            cpu, strerror(res));
+    }
+}
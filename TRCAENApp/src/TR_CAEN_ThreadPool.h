@@ -0,0 +1,40 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+#ifndef TR_CAEN_THREAD_POOL_H
+#define TR_CAEN_THREAD_POOL_H
+
+#include <TRWorkerThread.h>
+
+// Pool mode, configured by TR_CAEN_ConfigurePool before any device is
+// initialized. In pool mode, the digitizers on a link share one worker
+// thread for slow-control tasks (in addition to sharing the link scheduler
+// thread for readout), and these two threads of a link can be pinned to a
+// CPU. The read threads of the devices, which decode the data, are not
+// pinned, so that decoding for the devices on a link runs in parallel.
+class TR_CAEN_ThreadPool {
+public:
+    // Enables pool mode. The link_cpus string maps links to CPUs, for example
+    // "0:2,1:3" (may be empty for no pinning). Returns false if the arguments
+    // are not valid or if it is too late to configure.
+    static bool configure (char const *link_cpus, int worker_prio_epics, int worker_stack_size);
+    
+    // Returns the shared worker thread for the link (created and started on
+    // first use), or NULL if pool mode is not enabled. After this is called
+    // the pool cannot be configured anymore.
+    static TRWorkerThread * getWorkerForLink (int link_number);
+    
+    // Returns the CPU the threads of the link are pinned to, or -1.
+    static int getCpuForLink (int link_number);
+    
+    // Pins the calling thread to the CPU (if cpu >= 0).
+    static void pinCurrentThread (int cpu);
+};
+
+#endif
@@ -0,0 +1,136 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+// Checks that every sample unpack kernel gives output bit-identical to the
+// scalar kernel, for raw and scaled samples, and does not write past the
+// end of the output.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "TR_CAEN_SampleUnpack.h"
+
+// Numbers of samples tested: very small, odd and even numbers of words
+// around the vector widths, and a few larger ones. Odd numbers of samples
+// are included too, of which only the complete words are unpacked.
+static size_t const SampleCounts[] = {
+    0, 1, 2, 3, 4, 6, 8, 10, 14, 16, 18, 30, 32, 34, 62, 64, 66, 126, 1000, 1002, 4097
+};
+static int const NumSampleCounts = sizeof(SampleCounts) / sizeof(SampleCounts[0]);
+
+// Elements after the output which must not be written.
+static size_t const GuardElements = 64;
+
+// Byte pattern of the unwritten output.
+static unsigned char const GuardByte = 0xA5;
+
+// Checks per kernel, sample count and format (output and guard).
+static int const ChecksPerCase = 2;
+
+// Conversion to volts as used by the driver (2 V range).
+static float const Scale = 2.0f / 16384.0f;
+static float const Offset = -1.0f;
+
+// Fills the input words with pseudo-random data, including the bits
+// which are not part of the samples.
+static void fillWords (std::vector<uint32_t> &words)
+{
+    uint32_t state = 12345;
+    for (size_t i = 0; i < words.size(); i++) {
+        state = state * 1664525u + 1013904223u;
+        words[i] = state;
+    }
+}
+
+// Runs the raw or scaled unpack of a kernel into an output prefilled with
+// the guard pattern. The output starts one element into the buffer so that
+// it is not aligned.
+template <typename SampleType>
+static void runKernel (TR_CAEN_UnpackKernel const *kernel, uint32_t const *src, size_t num_samples,
+                       std::vector<SampleType> &out)
+{
+    out.resize(1 + num_samples + GuardElements);
+    ::memset(&out[0], GuardByte, out.size() * sizeof(SampleType));
+    SampleType *dst = &out[1];
+    
+    // Dispatch on the output type.
+    if (sizeof(SampleType) == sizeof(int16_t)) {
+        kernel->unpack(src, (int16_t *)dst, num_samples);
+    } else {
+        kernel->unpack_scaled(src, (float *)dst, num_samples, Scale, Offset);
+    }
+}
+
+// Returns whether the elements in [start, end) still have the guard pattern.
+template <typename SampleType>
+static bool guardIntact (std::vector<SampleType> const &out, size_t start, size_t end)
+{
+    unsigned char const *bytes = (unsigned char const *)&out[0];
+    for (size_t i = start * sizeof(SampleType); i < end * sizeof(SampleType); i++) {
+        if (bytes[i] != GuardByte) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename SampleType>
+static void testKernel (TR_CAEN_UnpackKernel const *ref_kernel, TR_CAEN_UnpackKernel const *kernel,
+                        char const *format, uint32_t const *src, size_t num_samples)
+{
+    std::vector<SampleType> ref_out;
+    std::vector<SampleType> out;
+    runKernel(ref_kernel, src, num_samples, ref_out);
+    runKernel(kernel, src, num_samples, out);
+    
+    // Only complete words are unpacked.
+    size_t unpacked = num_samples - num_samples % 2;
+    
+    testOk(::memcmp(&out[0], &ref_out[0], (1 + unpacked) * sizeof(SampleType)) == 0,
+           "%s %s: %lu samples identical to scalar", kernel->name, format, (unsigned long)num_samples);
+    
+    testOk(guardIntact(out, 0, 1) && guardIntact(out, 1 + unpacked, out.size()),
+           "%s %s: %lu samples, nothing written outside the output", kernel->name, format, (unsigned long)num_samples);
+}
+
+MAIN(testSampleUnpack)
+{
+    testPlan(TR_CAEN_NumUnpackImpls * NumSampleCounts * 2 * ChecksPerCase);
+    
+    TR_CAEN_UnpackKernel const *ref_kernel = TR_CAEN_GetUnpackKernel(TR_CAEN_UnpackImplScalar);
+    
+    // Input with one extra word at the start, so that it is not aligned
+    // either, and after the end, which must not be read into the output.
+    std::vector<uint32_t> words(1 + SampleCounts[NumSampleCounts - 1] / 2 + 1);
+    fillWords(words);
+    uint32_t const *src = &words[1];
+    
+    for (int impl = 0; impl < TR_CAEN_NumUnpackImpls; impl++) {
+        TR_CAEN_UnpackKernel const *kernel = TR_CAEN_GetUnpackKernel((TR_CAEN_UnpackImpl)impl);
+        if (kernel == NULL) {
+            testSkip(NumSampleCounts * 2 * ChecksPerCase, "kernel not supported on this CPU or build");
+            continue;
+        }
+        
+        testDiag("Kernel %s", kernel->name);
+        
+        for (int i = 0; i < NumSampleCounts; i++) {
+            testKernel<int16_t>(ref_kernel, kernel, "raw", src, SampleCounts[i]);
+            testKernel<float>(ref_kernel, kernel, "volts", src, SampleCounts[i]);
+        }
+    }
+    
+    return testDone();
+}
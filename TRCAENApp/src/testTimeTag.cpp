@@ -0,0 +1,137 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+// Checks the extension of the trigger time tags to 64 bits, with rollovers
+// of the counter between events and in gaps longer than the counter period.
+
+#include <stdint.h>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "TR_CAEN_Decoder.h"
+
+// Period of the time tag counter, in ticks and seconds.
+static uint64_t const Period = (uint64_t)1 << TR_CAEN_TimeTagBits;
+static double const PeriodTime = Period / TR_CAEN_TimeTagFrequency;
+
+// Readout delay of the events in the tests with the host time (seconds).
+static double const ReadoutDelay = 0.01;
+
+// Returns the extended time tag of an event at the given time since the
+// counter was reset.
+static uint64_t timeTagAt (double time)
+{
+    return (uint64_t)(time * TR_CAEN_TimeTagFrequency);
+}
+
+// Returns the trigger time tag reported for an extended time tag, with the
+// rollover flag set after a rollover like the digitizer does.
+static uint32_t triggerTimeTag (uint64_t time_tag)
+{
+    uint32_t trigger_time_tag = time_tag & (Period - 1);
+    if (time_tag >= Period) {
+        trigger_time_tag |= (uint32_t)1 << TR_CAEN_TimeTagBits;
+    }
+    return trigger_time_tag;
+}
+
+// Extends the time tag of an event at the given time, which is read out at
+// read_time (negative for no host time), and checks the result.
+static void checkEvent (TR_CAEN_TimeTagExtender &extender, char const *what, double time, double read_time,
+                        uint64_t expected, bool expected_ambiguous)
+{
+    bool ambiguous = !expected_ambiguous;
+    uint64_t time_tag = extender.extend(triggerTimeTag(timeTagAt(time)), read_time, &ambiguous);
+    testOk(time_tag == expected && ambiguous == expected_ambiguous,
+           "%s: time tag %llu (expected %llu), ambiguous %d (expected %d)", what,
+           (unsigned long long)time_tag, (unsigned long long)expected, (int)ambiguous, (int)expected_ambiguous);
+}
+
+static void testWithoutHostTime ()
+{
+    testDiag("Without the host time");
+    
+    TR_CAEN_TimeTagExtender extender;
+    checkEvent(extender, "first event", 1.0, -1.0, timeTagAt(1.0), false);
+    checkEvent(extender, "event before rollover", 17.0, -1.0, timeTagAt(17.0), false);
+    checkEvent(extender, "event after rollover", 18.0, -1.0, timeTagAt(18.0), false);
+    
+    // A rollover in a gap of more than a period cannot be detected.
+    checkEvent(extender, "event after gap", 18.0 + PeriodTime + 1.0, -1.0, timeTagAt(19.0), false);
+    
+    extender.reset();
+    checkEvent(extender, "event after reset", 2.0, -1.0, timeTagAt(2.0), false);
+}
+
+static void testWithHostTime ()
+{
+    testDiag("With the host time");
+    
+    TR_CAEN_TimeTagExtender extender;
+    checkEvent(extender, "first event", 1.0, 1.0 + ReadoutDelay, timeTagAt(1.0), false);
+    checkEvent(extender, "event after rollover", 18.0, 18.0 + ReadoutDelay, timeTagAt(18.0), false);
+    
+    // Rollovers in gaps of one or more periods are found with the host time,
+    // but flagged as they assume that the event was read out without delay.
+    double time = 18.0 + PeriodTime + 1.0;
+    checkEvent(extender, "event after gap of one period", time, time + ReadoutDelay, timeTagAt(time), true);
+    time += 3 * PeriodTime + 2.0;
+    checkEvent(extender, "event after gap of three periods", time, time + ReadoutDelay, timeTagAt(time), true);
+    time += 1.0;
+    checkEvent(extender, "event after short gap", time, time + ReadoutDelay, timeTagAt(time), false);
+    
+    // An event read out more than a period late is taken to be one period
+    // later, which is flagged.
+    time += 1.0;
+    checkEvent(extender, "event read out late", time, time + PeriodTime + 1.0, timeTagAt(time + PeriodTime), true);
+    
+    // Host time before the previous event is inconsistent, the time tags
+    // alone are used.
+    extender.reset();
+    checkEvent(extender, "first event after reset", 5.0, 5.0 + ReadoutDelay, timeTagAt(5.0), false);
+    checkEvent(extender, "event with host time behind", 10.0, 2.0, timeTagAt(10.0), true);
+}
+
+// Checks events every interval seconds for duration seconds, with the
+// counter running at the given rate relative to the host clock.
+static void testDrift (double rate, double interval, double duration)
+{
+    TR_CAEN_TimeTagExtender extender;
+    int num_wrong = 0;
+    int num_ambiguous = 0;
+    
+    for (double host_time = interval; host_time < duration; host_time += interval) {
+        double time = host_time * rate;
+        bool ambiguous;
+        uint64_t time_tag = extender.extend(triggerTimeTag(timeTagAt(time)), host_time + ReadoutDelay, &ambiguous);
+        num_wrong += time_tag != timeTagAt(time);
+        num_ambiguous += ambiguous;
+    }
+    
+    testOk(num_wrong == 0 && num_ambiguous == 0,
+           "counter rate %g, events every %g s for %g s: %d wrong, %d ambiguous",
+           rate, interval, duration, num_wrong, num_ambiguous);
+}
+
+MAIN(testTimeTag)
+{
+    testPlan(17);
+    
+    testWithoutHostTime();
+    testWithHostTime();
+    
+    testDiag("Drift between the host clock and the counter");
+    testDrift(1.0 + 50e-6, 10.0, 3 * 86400.0);
+    testDrift(1.0 - 50e-6, 10.0, 3 * 86400.0);
+    testDrift(1.0 + 50e-6, 1.0, 3600.0);
+    testDrift(1.0 - 50e-6, 1.0, 3600.0);
+    
+    return testDone();
+}
@@ -0,0 +1,141 @@
+/* This file is part of the CAEN Digitizer Driver.
+ * It is subject to the license terms in the LICENSE.txt file found in the
+ * top-level directory of this distribution and at
+ * https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. No part
+ * of the CAEN Digitizer Driver, including this file, may be copied,
+ * modified, propagated, or distributed except according to the terms
+ * contained in the LICENSE.txt file.
+ */
+
+// Checks the decoding of the channel data in ZLE format on hand-built
+// channel blocks.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "TR_CAEN_Decoder.h"
+
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+// An expected segment, with the data words holding its samples.
+struct ExpectedSegment {
+    size_t sample_offset;
+    size_t num_samples;
+    uint32_t const *words;
+};
+
+// Decodes the channel block in data (num_words words available) and checks
+// the result, the segments and the samples in them.
+static void checkDecode (char const *what, uint32_t const *data, size_t num_words, bool expected_ok,
+                         ExpectedSegment const *expected, size_t num_expected,
+                         size_t expected_ch_words, size_t expected_record_samples)
+{
+    std::vector<TR_CAEN_ZleSegment> segments;
+    size_t ch_words = 0;
+    size_t record_samples = 0;
+    bool ok = TR_CAEN_DecodeZleChannel(data, num_words, segments, &ch_words, &record_samples);
+    
+    if (!expected_ok) {
+        testOk(!ok, "%s: rejected", what);
+        return;
+    }
+    
+    if (!ok) {
+        testFail("%s: not decoded", what);
+        return;
+    }
+    
+    if (ch_words != expected_ch_words || record_samples != expected_record_samples ||
+        segments.size() != num_expected)
+    {
+        testFail("%s: %u words, %u samples, %u segments (expected %u, %u, %u)", what,
+                 (unsigned int)ch_words, (unsigned int)record_samples, (unsigned int)segments.size(),
+                 (unsigned int)expected_ch_words, (unsigned int)expected_record_samples,
+                 (unsigned int)num_expected);
+        return;
+    }
+    
+    for (size_t i = 0; i < num_expected; i++) {
+        TR_CAEN_ZleSegment const &segment = segments[i];
+        if (segment.sample_offset != expected[i].sample_offset ||
+            segment.num_samples != expected[i].num_samples ||
+            memcmp(segment.data, expected[i].words, segment.num_samples / 2 * sizeof(uint32_t)) != 0)
+        {
+            testFail("%s: segment %u at %u with %u samples (expected at %u with %u samples) or wrong samples",
+                     what, (unsigned int)i, (unsigned int)segment.sample_offset,
+                     (unsigned int)segment.num_samples, (unsigned int)expected[i].sample_offset,
+                     (unsigned int)expected[i].num_samples);
+            return;
+        }
+    }
+    
+    testPass("%s", what);
+}
+
+static void testSkipThenGood ()
+{
+    uint32_t const data[] = {4, 0x00000003, 0x80000001, 0x00050006};
+    uint32_t const words[] = {0x00050006};
+    ExpectedSegment const expected[] = {{6, 2, words}};
+    checkDecode("skip then good", data, ARRAY_SIZE(data), true, expected, ARRAY_SIZE(expected), 4, 8);
+}
+
+static void testGoodThenGood ()
+{
+    // The control word between the blocks must not end up in the samples.
+    uint32_t const data[] = {6, 0x80000002, 0x00010002, 0x00030004, 0x80000001, 0x00050006};
+    uint32_t const words0[] = {0x00010002, 0x00030004};
+    uint32_t const words1[] = {0x00050006};
+    ExpectedSegment const expected[] = {{0, 4, words0}, {4, 2, words1}};
+    checkDecode("good then good", data, ARRAY_SIZE(data), true, expected, ARRAY_SIZE(expected), 6, 6);
+}
+
+static void testZeroLengthSkip ()
+{
+    uint32_t const data[] = {6, 0x80000001, 0x00010002, 0x00000000, 0x80000001, 0x00030004};
+    uint32_t const words0[] = {0x00010002};
+    uint32_t const words1[] = {0x00030004};
+    ExpectedSegment const expected[] = {{0, 2, words0}, {2, 2, words1}};
+    checkDecode("zero-length skip", data, ARRAY_SIZE(data), true, expected, ARRAY_SIZE(expected), 6, 4);
+}
+
+static void testFollowedByNextChannel ()
+{
+    // Only the words given by the size belong to the channel.
+    uint32_t const data[] = {3, 0x80000001, 0x00010002, 0x80000001, 0xdeadbeef};
+    uint32_t const words[] = {0x00010002};
+    ExpectedSegment const expected[] = {{0, 2, words}};
+    checkDecode("followed by next channel", data, ARRAY_SIZE(data), true, expected, ARRAY_SIZE(expected), 3, 2);
+}
+
+static void testTruncatedGood ()
+{
+    uint32_t const data[] = {3, 0x80000002, 0x00010002};
+    checkDecode("truncated good block", data, ARRAY_SIZE(data), false, NULL, 0, 0, 0);
+}
+
+static void testSizeBeyondBuffer ()
+{
+    uint32_t const data[] = {5, 0x80000001, 0x00010002};
+    checkDecode("size beyond buffer", data, ARRAY_SIZE(data), false, NULL, 0, 0, 0);
+}
+
+MAIN(testZleDecode)
+{
+    testPlan(6);
+    
+    testSkipThenGood();
+    testGoodThenGood();
+    testZeroLengthSkip();
+    testFollowedByNextChannel();
+    testTruncatedGood();
+    testSizeBeyondBuffer();
+    
+    return testDone();
+}
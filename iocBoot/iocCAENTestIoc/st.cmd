@@ -5,7 +5,11 @@
 cd ${TOP}
 
 ## Basic configuration
-# device identification
+# device identification (link:node, or a node list such as 0:0-7 or 0:0,1,2
+# for daisy-chained digitizers, which get ports named DEVICE_NAME_<node>),
+# or "sim" for a simulated digitizer, optionally with options such as
+# "sim:rate=1000,shape=pulse,amplitude=4000,noise=4,boards=2", or
+# "replay:<file>" to replay a raw recording, e.g. "replay:speed=0,loop=1:<file>")
 epicsEnvSet("CAEN_DEVICE", "0:0")
 # prefix of all records
 epicsEnvSet("PREFIX", "CAEN")
@@ -53,6 +57,12 @@ epicsEnvSet("SNAP_SCAN", "1 second")
 dbLoadDatabase "dbd/CAENTestIoc.dbd"
 CAENTestIoc_registerRecordDeviceDriver pdbbase
 
+# Optionally share the worker thread between the digitizers on each link and
+# pin the link reader and worker threads to CPUs (link:cpu list, worker
+# priority, stack size). The read threads decoding the data are not pinned.
+# This must come before TR_CAEN_InitDevice.
+#TR_CAEN_ConfigurePool("0:2", "50", "0")
+
 # Initialize the main port.
 TR_CAEN_InitDevice("$(DEVICE_NAME)", "$(CAEN_DEVICE)", "$(READ_THREAD_PRIORITY_EPICS)", "$(READ_THREAD_STACK_SIZE)", "$(MAX_AD_BUFFERS)", "$(MAX_AD_MEMORY)")
 
@@ -60,7 +70,7 @@ TR_CAEN_InitDevice("$(DEVICE_NAME)", "$(CAEN_DEVICE)", "$(READ_THREAD_PRIORITY_E
 < iocBoot/iocCAENTestIoc/CAENInitChannels.cmd
 
 # Load main records.
-dbLoadRecords("$(TR_CORE)/db/TRBase.db", "PREFIX=$(PREFIX), PORT=$(DEVICE_NAME), SIZE=$(WAVEFORM_SIZE), PRESAMPLES=#")
+dbLoadRecords("$(TR_CORE)/db/TRBase.db", "PREFIX=$(PREFIX), PORT=$(DEVICE_NAME), SIZE=$(WAVEFORM_SIZE), PRESAMPLES=")
 dbLoadRecords("db/TRCAEN.db", "PREFIX=$(PREFIX), PORT=$(DEVICE_NAME), REFRESH_STATES_SCAN=$(REFRESH_STATES_SCAN), HW_SAMPLE_RATE=$(HW_SAMPLE_RATE)")
 dbLoadRecords("$(TR_CORE)/db/TRGenericRequest.db", "PREFIX=$(PREFIX), PORT=$(DEVICE_NAME), REQUEST=RESET")
 dbLoadRecords("$(TR_CORE)/db/TRGenericRequest.db", "PREFIX=$(PREFIX), PORT=$(DEVICE_NAME), REQUEST=CALIBRATE")
@@ -69,6 +79,31 @@ dbLoadRecords("$(TR_CORE)/db/TRGenericRequest.db", "PREFIX=$(PREFIX), PORT=$(DEV
 # Load channel-specific records (generated using gen_channels.py).
 < iocBoot/iocCAENTestIoc/CAENLoadChannelsDb.cmd
 
+# With a node list (for example CAEN_DEVICE "0:0,1"), each digitizer has its
+# own ports named $(DEVICE_NAME)_<node>, so instead of the channel ports and
+# records above, set them up for each node with a distinct prefix. The channel
+# command files use DEVICE_NAME and PREFIX, which are set to the node's ones.
+#dbLoadRecords("$(TR_CORE)/db/TRBase.db", "PREFIX=$(PREFIX):N0, PORT=$(DEVICE_NAME)_0, SIZE=$(WAVEFORM_SIZE), PRESAMPLES=")
+#dbLoadRecords("db/TRCAEN.db", "PREFIX=$(PREFIX):N0, PORT=$(DEVICE_NAME)_0, REFRESH_STATES_SCAN=$(REFRESH_STATES_SCAN), HW_SAMPLE_RATE=$(HW_SAMPLE_RATE)")
+#dbLoadRecords("$(TR_CORE)/db/TRGenericRequest.db", "PREFIX=$(PREFIX):N0, PORT=$(DEVICE_NAME)_0, REQUEST=RESET")
+#dbLoadRecords("$(TR_CORE)/db/TRGenericRequest.db", "PREFIX=$(PREFIX):N0, PORT=$(DEVICE_NAME)_0, REQUEST=CALIBRATE")
+#dbLoadRecords("$(TR_CORE)/db/TRGenericRequest.db", "PREFIX=$(PREFIX):N0, PORT=$(DEVICE_NAME)_0, REQUEST=REFRESH")
+#dbLoadRecords("$(TR_CORE)/db/TRBase.db", "PREFIX=$(PREFIX):N1, PORT=$(DEVICE_NAME)_1, SIZE=$(WAVEFORM_SIZE), PRESAMPLES=")
+#dbLoadRecords("db/TRCAEN.db", "PREFIX=$(PREFIX):N1, PORT=$(DEVICE_NAME)_1, REFRESH_STATES_SCAN=$(REFRESH_STATES_SCAN), HW_SAMPLE_RATE=$(HW_SAMPLE_RATE)")
+#dbLoadRecords("$(TR_CORE)/db/TRGenericRequest.db", "PREFIX=$(PREFIX):N1, PORT=$(DEVICE_NAME)_1, REQUEST=RESET")
+#dbLoadRecords("$(TR_CORE)/db/TRGenericRequest.db", "PREFIX=$(PREFIX):N1, PORT=$(DEVICE_NAME)_1, REQUEST=CALIBRATE")
+#dbLoadRecords("$(TR_CORE)/db/TRGenericRequest.db", "PREFIX=$(PREFIX):N1, PORT=$(DEVICE_NAME)_1, REQUEST=REFRESH")
+#epicsEnvSet("CHAIN_NAME", "$(DEVICE_NAME)")
+#epicsEnvSet("CHAIN_PREFIX", "$(PREFIX)")
+#epicsEnvSet("DEVICE_NAME", "$(CHAIN_NAME)_0")
+#epicsEnvSet("PREFIX", "$(CHAIN_PREFIX):N0")
+#< iocBoot/iocCAENTestIoc/CAENInitChannels.cmd
+#< iocBoot/iocCAENTestIoc/CAENLoadChannelsDb.cmd
+#epicsEnvSet("DEVICE_NAME", "$(CHAIN_NAME)_1")
+#epicsEnvSet("PREFIX", "$(CHAIN_PREFIX):N1")
+#< iocBoot/iocCAENTestIoc/CAENInitChannels.cmd
+#< iocBoot/iocCAENTestIoc/CAENLoadChannelsDb.cmd
+
 # Initialize IOC.
 cd ${TOP}/iocBoot/${IOC}
 iocInit